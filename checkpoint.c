@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "checkpoint.h"
+
+/* ******************************************************************
+   fork() based checkpoints: the child process is the snapshot, so no
+   simulator or protocol state needs to be serialised.
+**********************************************************************/
+
+double checkpoint_time = -1.0;
+int checkpoint_msgs = -1;
+
+static const char *branches[MAXBRANCHES];
+static int nbranches = 0;
+static int taken = 0;   /* checkpoint already reached */
+static int thisbranch = 0;  /* the branch a child runs, 0 in the parent */
+
+void checkpoint_add_branch(const char *spec)
+{
+  if (nbranches == MAXBRANCHES) {
+    printf("too many branches (at most %d)\n", MAXBRANCHES);
+    exit(EXIT_FAILURE);
+  }
+  branches[nbranches++] = spec;
+}
+
+int checkpoint_branches(void)
+{
+  return nbranches;
+}
+
+void checkpoint_clear(void)
+{
+  checkpoint_time = -1.0;
+  checkpoint_msgs = -1;
+  nbranches = 0;
+  taken = 0;
+}
+
+int checkpoint_due(double now, int nmsgs)
+{
+  if (taken || nbranches == 0)
+    return 0;
+  if ((checkpoint_time >= 0.0 && now >= checkpoint_time) ||
+      (checkpoint_msgs >= 0 && nmsgs >= checkpoint_msgs)) {
+    taken = 1;
+    return 1;
+  }
+  return 0;
+}
+
+const char *checkpoint_fork(void)
+{
+  pid_t pid;
+  int i, status;
+
+  for (i = 0; i < nbranches; i++) {
+    fflush(stdout);           /* do not let the child repeat buffered output */
+    pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      thisbranch = i + 1;
+      printf("\n-----  Branch %d: %s -------- \n", i + 1, branches[i]);
+      return branches[i];
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      printf("Warning: branch %d (%s) did not complete\n", i + 1, branches[i]);
+  }
+  printf("\n-----  Branch 0: baseline -------- \n");
+  return NULL;
+}
+
+int checkpoint_branch(void)
+{
+  return thisbranch;
+}
@@ -0,0 +1,35 @@
+/* ******************************************************************
+   Simulation checkpoints and what-if branching.
+
+   When the run reaches the checkpoint (a virtual time or a number of
+   messages handed to layer 4) the whole simulator is snapshotted with
+   fork(): event list, random number generator, emulator counters and
+   the protocol's window buffers and timers are all shared copy-on-write
+   with one child per branch.  Each child applies its own parameter
+   overrides and runs to completion; the parent waits for them in turn
+   and then finishes the unmodified baseline run.
+**********************************************************************/
+
+#define MAXBRANCHES 64
+
+extern double checkpoint_time;  /* virtual time of the checkpoint, < 0 if unset */
+extern int checkpoint_msgs;     /* message count of the checkpoint, < 0 if unset */
+
+/* add a continuation, spec is a comma separated list of name=value */
+extern void checkpoint_add_branch(const char *spec);
+
+/* the number of branches added */
+extern int checkpoint_branches(void);
+
+/* forget the checkpoint and its branches, as before any option */
+extern void checkpoint_clear(void);
+
+/* has the run reached the checkpoint (only true once) */
+extern int checkpoint_due(double now, int nmsgs);
+
+/* fork the branches.  Returns the branch spec in a child, NULL in the
+   parent once every child has finished */
+extern const char *checkpoint_fork(void);
+
+/* the branch this process runs, 1 for the first, 0 for the baseline */
+extern int checkpoint_branch(void);
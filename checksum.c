@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "emulator.h"
+#include "checksum.h"
+#include "payload.h"
+#include "instrument.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_ARM_CRC 1
+#endif
+#define HAVE_NEON 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u   /* Castagnoli, reflected */
+#define CKSUM_BYTES (2 * sizeof(int) + 20)
+
+int checksum_engine = CKSUM_ADDITIVE;
+
+typedef int (*sumfn)(const char *, size_t);
+typedef uint32_t (*crcfn)(uint32_t, const unsigned char *, size_t);
+typedef int (*cksumfn)(const struct pkt *);
+
+static uint32_t crctab[8][256];
+static sumfn sum_impl;
+static crcfn crc_impl;
+
+/* the header fields of a segment that the checksum also covers */
+static void segbytes(const struct pkt *packet, unsigned char buf[3 * sizeof(int)])
+{
+  memcpy(buf, &packet->length, sizeof(int));
+  memcpy(buf + sizeof(int), &packet->offset, sizeof(int));
+  memcpy(buf + 2 * sizeof(int), &packet->msglen, sizeof(int));
+}
+
+/**************************** additive *****************************/
+
+static int sum_scalar(const char *p, size_t n)
+{
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    sum += (int)(p[i]);
+  return sum;
+}
+
+#if defined(HAVE_X86)
+/* sum of absolute differences against zero adds 8 bytes per lane */
+__attribute__((target("sse2")))
+static int sum_sse2(const char *p, size_t n)
+{
+  __m128i acc = _mm_setzero_si128(), v;
+  int sum;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(p + i));
+#if CHAR_MIN < 0
+    v = _mm_xor_si128(v, _mm_set1_epi8((char)0x80));   /* signed to biased */
+#endif
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+  }
+  sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#if CHAR_MIN < 0
+  sum -= (int)i * 128;
+#endif
+  return sum + sum_scalar(p + i, n - i);
+}
+#elif defined(HAVE_NEON)
+static int sum_neon(const char *p, size_t n)
+{
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+#if CHAR_MIN < 0
+    sum += vaddlvq_s8(vld1q_s8((const int8_t *)(p + i)));
+#else
+    sum += vaddlvq_u8(vld1q_u8((const uint8_t *)(p + i)));
+#endif
+  return sum + sum_scalar(p + i, n - i);
+}
+#endif
+
+/* the original checksum: seqnum + acknum + payload bytes */
+static int additive(const struct pkt *packet, sumfn sum)
+{
+  int checksum;
+
+  checksum = packet->seqnum;
+  checksum += packet->acknum;
+  checksum += sum(packet->payload, 20);
+  if (packet->buf != NULL) {
+    checksum += packet->length + packet->offset + packet->msglen;
+    checksum += sum(packet->buf->data + packet->offset, packet->length);
+  }
+  return checksum;
+}
+
+static int additive_scalar(const struct pkt *packet)
+{
+  return additive(packet, sum_scalar);
+}
+
+static int additive_best(const struct pkt *packet)
+{
+  return additive(packet, sum_impl);
+}
+
+/**************************** CRC-32C ******************************/
+
+static void crcinit(void)
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    crctab[0][i] = c;
+  }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crctab[k][i] = (crctab[k - 1][i] >> 8) ^ crctab[0][crctab[k - 1][i] & 0xff];
+}
+
+/* the bytes covered by the checksum, in memory order */
+static void cksumbytes(const struct pkt *packet, unsigned char buf[CKSUM_BYTES])
+{
+  memcpy(buf, &packet->seqnum, sizeof(int));
+  memcpy(buf + sizeof(int), &packet->acknum, sizeof(int));
+  memcpy(buf + 2 * sizeof(int), packet->payload, 20);
+}
+
+static uint32_t crc_slice8(uint32_t crc, const unsigned char *p, size_t n)
+{
+  uint32_t lo, hi;
+
+  for (; n >= 8; n -= 8, p += 8) {
+    lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+    crc = crctab[7][lo & 0xff] ^ crctab[6][(lo >> 8) & 0xff] ^
+          crctab[5][(lo >> 16) & 0xff] ^ crctab[4][lo >> 24] ^
+          crctab[3][hi & 0xff] ^ crctab[2][(hi >> 8) & 0xff] ^
+          crctab[1][(hi >> 16) & 0xff] ^ crctab[0][hi >> 24];
+  }
+  for (; n > 0; n--, p++)
+    crc = crctab[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(HAVE_X86) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc32, const unsigned char *p, size_t n)
+{
+  uint64_t crc = crc32, w;
+
+  for (; n >= 8; n -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    crc = _mm_crc32_u64(crc, w);
+  }
+  for (; n > 0; n--, p++)
+    crc = _mm_crc32_u8((uint32_t)crc, *p);
+  return (uint32_t)crc;
+}
+#elif defined(HAVE_ARM_CRC)
+static uint32_t crc_arm(uint32_t crc, const unsigned char *p, size_t n)
+{
+  uint64_t w;
+
+  for (; n >= 8; n -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    crc = __crc32cd(crc, w);
+  }
+  for (; n > 0; n--, p++)
+    crc = __crc32cb(crc, *p);
+  return crc;
+}
+#endif
+
+/* CRC-32C of seqnum, acknum and payload, then of the segment if any */
+static int crc32c(const struct pkt *packet, crcfn update)
+{
+  unsigned char buf[CKSUM_BYTES];
+  uint32_t crc;
+
+  cksumbytes(packet, buf);
+  crc = update(0xFFFFFFFFu, buf, CKSUM_BYTES);
+  if (packet->buf != NULL) {
+    segbytes(packet, buf);
+    crc = update(crc, buf, 3 * sizeof(int));
+    crc = update(crc, (const unsigned char *)packet->buf->data + packet->offset, packet->length);
+  }
+  return (int)~crc;
+}
+
+static int crc32c_slice8(const struct pkt *packet)
+{
+  return crc32c(packet, crc_slice8);
+}
+
+static int crc32c_best(const struct pkt *packet)
+{
+  return crc32c(packet, crc_impl);
+}
+
+/************************** selection ******************************/
+
+void checksum_init(void)
+{
+  crcinit();
+  sum_impl = sum_scalar;
+  crc_impl = crc_slice8;
+#if defined(HAVE_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    sum_impl = sum_sse2;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2"))
+    crc_impl = crc_sse42;
+#endif
+#elif defined(HAVE_NEON)
+  sum_impl = sum_neon;
+#if defined(HAVE_ARM_CRC)
+  crc_impl = crc_arm;
+#endif
+#endif
+}
+
+int checksum_select(const char *name)
+{
+  if (strcmp(name, "additive") == 0)
+    checksum_engine = CKSUM_ADDITIVE;
+  else if (strcmp(name, "crc32c") == 0)
+    checksum_engine = CKSUM_CRC32C;
+  else
+    return 0;
+  return 1;
+}
+
+int pkt_checksum(const struct pkt *packet)
+{
+  if (checksum_engine == CKSUM_CRC32C)
+    return crc32c(packet, crc_impl);
+  return additive(packet, sum_impl);
+}
+
+unsigned int checksum_bytes(const char *data, int n)
+{
+  return ~crc_impl(0xFFFFFFFFu, (const unsigned char *)data, n);
+}
+
+/************************** self test ******************************/
+
+#define BENCHPKTS 1024       /* distinct packets cycled through */
+#define BENCHREPS 2000       /* passes over them when timing */
+#define TRIALS    200000     /* corruptions tried per pattern */
+#define NPATTERNS 7
+
+static const char *patternnames[NPATTERNS] = {
+  "payload[0]='Z' (emulator)",
+  "seqnum=999999 (emulator)",
+  "acknum=999999 (emulator)",
+  "two payload bytes swapped",
+  "compensating +1/-1",
+  "one bit flipped",
+  "two bits flipped"
+};
+
+static void randompkt(struct pkt *p, double (*rng)(void))
+{
+  int i;
+
+  p->seqnum = (int)(rng() * 12);
+  p->acknum = rng() < 0.5 ? -1 : (int)(rng() * 12);
+  for (i = 0; i < 20; i++)
+    p->payload[i] = 'a' + (int)(rng() * 26) % 26;
+  p->checksum = 0;
+  p->length = p->offset = p->msglen = 0;
+  p->buf = NULL;
+}
+
+static int pick(int n, double (*rng)(void))
+{
+  return (int)(rng() * n) % n;
+}
+
+/* apply corruption pattern k, returns 0 if the packet did not change */
+static int corrupt(struct pkt *p, int k, double (*rng)(void))
+{
+  struct pkt orig = *p;
+  unsigned char *bytes = (unsigned char *)p;
+  int i, j;
+  char c;
+
+  switch (k) {
+  case 0: p->payload[0] = 'Z'; break;
+  case 1: p->seqnum = 999999; break;
+  case 2: p->acknum = 999999; break;
+  case 3:
+    i = pick(20, rng);
+    j = pick(20, rng);
+    c = p->payload[i];
+    p->payload[i] = p->payload[j];
+    p->payload[j] = c;
+    break;
+  case 4:
+    i = pick(20, rng);
+    j = (i + 1 + pick(19, rng)) % 20;
+    p->payload[i]++;
+    p->payload[j]--;
+    break;
+  case 5:
+  case 6:
+    for (j = 0; j < k - 4; j++) {
+      i = pick(CKSUM_BYTES, rng);       /* seqnum, acknum or payload */
+      if (i >= 2 * (int)sizeof(int))
+        i += offsetof(struct pkt, payload) - 2 * sizeof(int);
+      else if (i >= (int)sizeof(int))
+        i += offsetof(struct pkt, acknum) - sizeof(int);
+      bytes[i] ^= 1 << pick(8, rng);
+    }
+    break;
+  }
+  return orig.seqnum != p->seqnum || orig.acknum != p->acknum ||
+         memcmp(orig.payload, p->payload, 20) != 0;
+}
+
+static void evaluate(const char *name, cksumfn fn, struct pkt *pkts, double (*rng)(void))
+{
+  unsigned long long t0, t1;
+  unsigned int sink = 0;
+  struct pkt p;
+  int i, k, r, tried, missed;
+
+  t0 = instr_clock();
+  for (r = 0; r < BENCHREPS; r++)
+    for (i = 0; i < BENCHPKTS; i++)
+      sink += (unsigned int)fn(&pkts[i]);
+  t1 = instr_clock();
+  printf("%-22s %8.2f ns/pkt  ", name, (double)(t1 - t0) / ((double)BENCHREPS * BENCHPKTS));
+
+  for (k = 0; k < NPATTERNS; k++) {
+    for (tried = missed = i = 0; i < TRIALS; i++) {
+      p = pkts[i % BENCHPKTS];
+      p.checksum = fn(&p);
+      if (!corrupt(&p, k, rng))
+        continue;
+      tried++;
+      missed += p.checksum == fn(&p);
+    }
+    printf(" %7.3f%%", tried ? 100.0 * (tried - missed) / tried : 100.0);
+  }
+  printf("%s\n", sink == 1 ? " " : "");   /* keep the timed loop alive */
+}
+
+int checksum_selftest(double (*rng)(void))
+{
+  static struct pkt pkts[BENCHPKTS];
+  int i, k, failed = 0;
+
+  checksum_init();
+  for (i = 0; i < BENCHPKTS; i++)
+    randompkt(&pkts[i], rng);
+
+  /* every implementation of an engine must agree with the reference one */
+  for (i = 0; i < BENCHPKTS; i++)
+    if (additive_best(&pkts[i]) != additive_scalar(&pkts[i]) ||
+        crc32c_best(&pkts[i]) != crc32c_slice8(&pkts[i]))
+      failed++;
+  printf("-----  Checksum engines: cost per packet and detection rate -------- \n");
+  printf("implementation mismatches: %d of %d packets\n", failed, BENCHPKTS);
+  printf("detection rate per corruption pattern:\n");
+  for (k = 0; k < NPATTERNS; k++)
+    printf("  %d: %s\n", k + 1, patternnames[k]);
+  printf("%-22s %15s ", "engine", "cost");
+  for (k = 0; k < NPATTERNS; k++)
+    printf(" %8d", k + 1);
+  printf("\n");
+
+  evaluate("additive (scalar)", additive_scalar, pkts, rng);
+  if (sum_impl != sum_scalar)
+    evaluate("additive (simd)", additive_best, pkts, rng);
+  evaluate("crc32c (slice-by-8)", crc32c_slice8, pkts, rng);
+  if (crc_impl != crc_slice8)
+    evaluate("crc32c (hardware)", crc32c_best, pkts, rng);
+  return failed;
+}
@@ -0,0 +1,34 @@
+/* ******************************************************************
+   Selectable packet checksum engines.
+
+   - additive: the original sum of seqnum, acknum and the payload bytes,
+     bit for bit the same values, vectorised where the CPU allows
+   - crc32c:   CRC-32C (Castagnoli) over seqnum, acknum and payload,
+     using the SSE4.2 / ARMv8 crc32c instructions when present and a
+     portable slice-by-8 table implementation otherwise
+
+   For a segment of a larger message both also cover the segment's
+   length, offset and message size and its bytes in the shared buffer.
+
+   checksum_init() picks the implementations by CPU feature detection;
+   checksum_engine picks the algorithm (the protocols' checksums are
+   only compatible with peers using the same engine).
+   emulator.h must be included first.
+**********************************************************************/
+
+#define CKSUM_ADDITIVE 0
+#define CKSUM_CRC32C   1
+
+extern int checksum_engine;
+
+extern void checksum_init(void);
+extern int checksum_select(const char *name);   /* 0 if name is unknown */
+
+/* checksum of a packet with the selected engine */
+extern int pkt_checksum(const struct pkt *packet);
+
+/* CRC-32C of n bytes, whatever the engine */
+extern unsigned int checksum_bytes(const char *data, int n);
+
+/* cost per packet and detection rate of every engine, returns 0 on success */
+extern int checksum_selftest(double (*rng)(void));
@@ -36,24 +36,70 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "protocol.h"
+#include "sim.h"
+#include "instrument.h"
+#include "checkpoint.h"
+#include "replicate.h"
+#include "sampling.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
+#include "path.h"
+#include "parallel.h"
+#include "traffic.h"
+#include "stop.h"
+#include "verify.h"
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  struct pkt pkt;         /* the emulator's copy of that packet */
+  int flow;               /* flow the event belongs to */
+  struct pacer *pacer;    /* pacer to release (PACE_RELEASE only) */
+  unsigned long seq;      /* insertion order, breaks ties in evtime */
+  int heapidx;            /* position in the event list */
+  int step;               /* links of the path crossed so far */
+  int msgsize;            /* FROM_LAYER5: message size, 0 for the default */
+  struct event *next;     /* next in a run of events, or in the pool */
 };
 
-struct event *evlist = NULL;   /* the event list */
+/* a list of events, kept as a binary heap */
+struct evheap {
+  struct event **ev;
+  int len;                /* number of events on the list */
+  int cap;
+  unsigned long seq;      /* events inserted so far */
+};
+
+/* unused events */
+struct evpool {
+  struct event *free;
+  int n;
+};
+
+static struct evheap evlist;   /* the event list */
+static struct evpool evpool;
+#define EVCHUNK 64             /* events added to the pool at a time */
+
+/* the list new timers and arrivals go on, and the pool events come
+   from: the ones above, or when the flows run in windows (lpmode)
+   those of the flow running */
+static __thread struct evheap *curheap = &evlist;
+static __thread struct evpool *curpool = &evpool;
+static int lpmode = 0;         /* several flows as logical processes */
 
 /* possible events: */
-#define  TIMER_INTERRUPT 0  
-#define  FROM_LAYER5     1
-#define  FROM_LAYER3     2
+#define  TIMER_INTERRUPT SIM_TIMER_INTERRUPT
+#define  FROM_LAYER5     SIM_FROM_LAYER5
+#define  FROM_LAYER3     SIM_FROM_LAYER3
+#define  PACE_RELEASE    SIM_PACE_RELEASE
+#define  FROM_HOP        SIM_FROM_HOP  /* packet reaches a router on the path */
 
 #define  OFF             0
 #define  ON              1
@@ -61,103 +107,406 @@ struct event *evlist = NULL;   /* the event list */
 int TRACE = 3;
 
 /* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
+__thread int window_full;   /* count of the number of messages dropped due to full window */
+__thread int total_ACKs_received;
+__thread int packets_resent;       /* count of the number of packets resent  */
+__thread int new_ACKs;           /* count of the number of acks correctly received */
+__thread int packets_received;  /* count of the packets received by receiver */
+__thread int nacks_sent;        /* count of the negative acknowledgements sent by B */
+__thread int packets_resent_nack;  /* resends triggered by a NACK rather than a timeout */
+
+/* protocol options */
+int nack = 0;          /* B asks for missing packets with NACKs */
 
-/* statistics updated by emulator */
+/* statistics updated by emulator.  Those kept per thread are updated
+   by the flows' events; the others only by the channel */
 static int packets_lost;  
 static int packets_corrupt;
+static int packets_reordered;     /* held back for later packets to overtake */
+static int packets_overtaken;     /* times a packet overtook one held back */
+static int packets_duplicated;
 static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
+static __thread int packets_timeout;
+static __thread int messages_delivered;
+static __thread long long bytes_delivered;
+static int rcvbuf_now;            /* packets the receivers hold out of order */
+static int rcvbuf_max;            /* most held at once, without --threads */
+static __thread int rcvbuf_released;       /* held packets since delivered in order */
+static __thread double rcvbuf_delay;       /* summed time those packets were held */
+static __thread int recoveries;            /* missing packets that arrived after all */
+static int queuedpkts;            /* packets A put into the medium */
+static double queuedelay;         /* summed time they waited behind earlier ones */
+static __thread double recoverysum;        /* summed time they were missing */
 
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
+static __thread int nsim = 0;     /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static __thread float time = 0.000;
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
+static int msgsize_min = 0; /* message sizes are uniform on [min,max], */
+static int msgsize_max = 0; /* 0 for classic 20 byte messages */
 static int   ntolayer3;           /* number sent into layer 3 */
 static int   nlost;               /* number lost in media */
 static int ncorrupt;              /* number corrupted by media*/
+static int sampling = SAMPLE_BERNOULLI;  /* how loss/corruption are decided */
+static struct skipper lossskip[2];       /* per sending entity, geometric mode */
+static struct skipper corruptskip[2];
+static float reorderprob[2];      /* per sending entity, see --reorder */
+static int reorderdepth[2];       /* most later packets that overtake one */
+static float dupprob[2];          /* per sending entity, see --duplicate */
+
+/* steady-state measurement, used by replicated runs */
+static int warmup = 0;            /* deliveries discarded as initial transient */
+static double warmup_time;        /* time the warm-up period ended */
+static int warmup_resent;         /* packets_resent when warm-up ended */
+static __thread double lastdelivery;       /* time of the most recent delivery */
+static __thread double latencysum;         /* summed latency of post warm-up deliveries */
+
+/* callbacks of a program driving the emulator, see sim.h */
+static sim_delivery_fn *ondelivery = NULL;
+static void *ondeliveryarg;
+static sim_event_fn *onevent = NULL;
+static void *oneventarg;
+
+/* the per-thread statistics, swapped in and out with the flow running
+   when the flows are logical processes (see --threads) */
+struct counters {
+  int window_full, total_ACKs_received, packets_resent, new_ACKs;
+  int packets_received, nacks_sent, packets_resent_nack;
+  int packets_timeout, messages_delivered, rcvbuf_released, recoveries, nsim;
+  int fec_data_sent, fec_parity_sent, fec_recovered, pace_delayed;
+  long long bytes_delivered;
+  double rcvbuf_delay, recoverysum, lastdelivery, latencysum, pace_delay;
+};
+
+#define COUNTERS(X) X(window_full) X(total_ACKs_received) X(packets_resent) \
+  X(new_ACKs) X(packets_received) X(nacks_sent) X(packets_resent_nack) \
+  X(packets_timeout) X(messages_delivered) X(rcvbuf_released) X(recoveries) \
+  X(nsim) X(fec_data_sent) X(fec_parity_sent) X(fec_recovered) X(pace_delayed) \
+  X(bytes_delivered) X(rcvbuf_delay) X(recoverysum) X(latencysum) X(pace_delay)
+
+/* the sender/receiver pairs sharing the channel, see --flows */
+struct flow {
+  int nsim;                 /* messages from layer 5 so far */
+  int delivered;            /* messages handed to layer 5 */
+  long long bytes;          /* bytes handed to layer 5 */
+  double latencysum;        /* summed latency of those messages */
+  int resent;               /* packet resends by its A */
+  int dropped;              /* messages dropped due to full window */
+  int held;                 /* packets its receiver holds out of order */
+  double rcvsince;          /* time held last changed */
+  double rcvarea;           /* held integrated over time */
+  int rcvmax;               /* most packets held at once */
+  struct event *timer[2];   /* running timer of A and B, or NULL */
+  float *sendtimes;         /* layer 5 arrival times of accepted messages */
+  int sendcap, sendhead, sendtail;
+  struct traffic traffic;   /* its layer 5 arrivals, with --traffic */
+  const struct protocol *proto;   /* the protocol it runs, see --protocol */
+  struct verifier verifier; /* its deliveries, with --verify */
+  /* as a logical process (see --threads) */
+  struct evheap events;     /* its own events */
+  struct evpool pool;
+  unsigned short rng[3];    /* its random number stream */
+  unsigned long sends;      /* packets it handed to the channel */
+  struct counters counted;  /* its statistics while another flow runs */
+  float now;                /* time of the last event it handled */
+};
+
+static struct flow *flows = NULL;
+static int nflows = 1;
+static __thread int curflow = 0;  /* flow whose event is being handled */
+static float lastarrival[2];      /* latest arrival scheduled at A and at B */
+
+/* packets held back for reordering, per sending entity */
+#define REORDER_MAXDEPTH 64
+struct heldpkt {
+  struct event *ev;         /* its arrival */
+  float due;                /* when that is, unless overtaken sooner */
+  int left;                 /* later packets still to overtake it */
+};
+static struct heldpkt held[2][REORDER_MAXDEPTH];
+static int nheld[2];
+#define FLOWLINES 32              /* most flows reported one by one */
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
 /* system-supplied rand() function return an int in therange [0,mmm]        */
+/* With --threads every flow and the channel draw from streams of their     */
+/* own instead, so that the results do not depend on how the threads run.   */
 /****************************************************************************/
+static __thread unsigned short *stream = NULL;  /* NULL for rand() */
+static unsigned short chanrng[3];               /* the channel's stream */
+
 double jimsrand(void) 
 {
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  if (stream != NULL)
+    x = erand48(stream);     /* uniform in [0,1) */
+  else
+    x = rand()/mmm;          /* x should be uniform in [0,1] */
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
+/* seed stream number n of a run from the run's seed */
+static void seedstream(unsigned short s[3], unsigned int seed, unsigned int n)
+{
+  unsigned long long z = ((unsigned long long)seed << 32 | n) + 0x9E3779B97F4A7C15ULL;
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;   /* splitmix64 */
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  s[0] = (unsigned short)z;
+  s[1] = (unsigned short)(z >> 16);
+  s[2] = (unsigned short)(z >> 32);
+}
+
+/* handle the events of the given flow: in windows also take its event
+   list, pool and random stream */
+static void setflow(int flow)
+{
+  curflow = flow;
+  if (lpmode) {
+    curheap = &flows[flow].events;
+    curpool = &flows[flow].pool;
+    stream = flows[flow].rng;
+  }
+}
+
+/* have the flow's protocol act for it */
+static void bindflow(int flow)
+{
+  if (flows[flow].proto->bind != NULL)
+    flows[flow].proto->bind(flow);
+}
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+/* restart the geometric samplers after the probabilities are set */
+static void resetsampling(void)
 {
-  struct event *q,*qold;
+  int i;
 
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  if (sampling != SAMPLE_GEOMETRIC)
+    return;
+  for (i = A; i <= B; i++) {
+    skip_init(&lossskip[i], lossprob, jimsrand);
+    skip_init(&corruptskip[i], corruptprob, jimsrand);
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+}
+
+/* do losses and corruption apply to packets sent by AorB */
+static int impaired(int AorB)
+{
+  return !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+static int packetlost(int AorB)
+{
+  if (sampling == SAMPLE_GEOMETRIC)
+    return impaired(AorB) && skip_next(&lossskip[AorB], jimsrand);
+  return jimsrand() < lossprob && impaired(AorB);
+}
+
+static int packetcorrupted(int AorB)
+{
+  if (sampling == SAMPLE_GEOMETRIC)
+    return impaired(AorB) && skip_next(&corruptskip[AorB], jimsrand);
+  return jimsrand() < corruptprob && impaired(AorB);
+}
+
+/* send an event's packet over the next link of the path, and set the
+   event for its arrival at the far end.  Returns 0 if the link drops it */
+static int hopforward(struct event *evptr)
+{
+  int from = (evptr->eventity + 1) % 2;
+  int link = from == A ? evptr->step : path_hops - 1 - evptr->step;
+  double at, wait;
+
+  at = path_enter(link, from, time, jimsrand, &wait);
+  if (from == A)
+    queuedelay += wait;
+  if (at < 0.0) {
+    nlost++;
+    packets_lost++;
+    if (TRACE>0)
+      printf("          HOP: packet being %s at link %d\n",
+             at == PATH_QUEUEFULL ? "dropped (queue full)" : "lost", link);
+    return 0;
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+  evptr->step++;
+  evptr->evtime = at;
+  evptr->evtype = evptr->step < path_hops ? FROM_HOP : FROM_LAYER3;
+  return 1;
+}
+
+/* make sure at least n events can be taken from the pool without malloc */
+static void reserveevents(int n)
+{
+  struct evpool *pool = curpool;
+  struct event *chunk;
+  int i, k;
+
+  if (pool->n >= n)
+    return;
+  k = n - pool->n > EVCHUNK ? n - pool->n : EVCHUNK;
+  chunk = malloc(k * sizeof(struct event));
+  if (chunk == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < k; i++) {
+    chunk[i].next = pool->free;
+    pool->free = &chunk[i];
+  }
+  pool->n += k;
+}
+
+static struct event *allocevent(void)
+{
+  struct event *evptr;
+
+  reserveevents(1);
+  evptr = curpool->free;
+  curpool->free = evptr->next;
+  curpool->n--;
+  evptr->pktptr = NULL;
+  evptr->flow = curflow;
+  evptr->pacer = NULL;
+  INSTR_COUNT(INSTR_EVENT_ALLOCS);
+  return evptr;
+}
+
+static void freeevent(struct event *evptr)
+{
+  evptr->next = curpool->free;
+  curpool->free = evptr;
+  curpool->n++;
+}
+
+/* does event a leave the event list before event b: the earlier one
+   first, and of two at the same time the one inserted last, as when
+   the event list was a sorted linked list */
+static int evbefore(const struct event *a, const struct event *b)
+{
+  if (a->evtime != b->evtime)
+    return a->evtime < b->evtime;
+  return a->seq > b->seq;
+}
+
+static void evplace(struct evheap *h, int i, struct event *p)
+{
+  h->ev[i] = p;
+  p->heapidx = i;
+}
+
+static void siftup(struct evheap *h, int i)
+{
+  struct event *p = h->ev[i];
+
+  while (i > 0 && evbefore(p, h->ev[(i - 1) / 2])) {
+    evplace(h, i, h->ev[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  evplace(h, i, p);
+}
+
+static void siftdown(struct evheap *h, int i)
+{
+  struct event *p = h->ev[i];
+  int c;
+
+  while ((c = 2 * i + 1) < h->len) {
+    if (c + 1 < h->len && evbefore(h->ev[c + 1], h->ev[c]))
+      c++;
+    if (!evbefore(h->ev[c], p))
+      break;
+    evplace(h, i, h->ev[c]);
+    i = c;
+  }
+  evplace(h, i, p);
+}
+
+/* take an event off an event list, wherever it is */
+static void removeevent(struct evheap *h, struct event *p)
+{
+  int i = p->heapidx;
+
+  h->len--;
+  if (i < h->len) {
+    evplace(h, i, h->ev[h->len]);
+    siftup(h, i);
+    siftdown(h, i);
+  }
+  INSTR_GAUGE(INSTR_EVLIST_DEPTH, h->len);
+}
+
+/* insert a chain of events, linked by next */
+static void insertrun(struct evheap *h, struct event *run)
+{
+  struct event *p, *nextp;
+  INSTR_START(t0);
+
+  for (p = run; p != NULL; p = nextp) {
+    nextp = p->next;
+    if (TRACE>2) {
+      printf("            INSERTEVENT: time is %f\n",time);
+      printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+    if (h->len == h->cap) {
+      h->cap = h->cap ? 2 * h->cap : 256;
+      h->ev = realloc(h->ev, h->cap * sizeof(struct event *));
+      if (h->ev == NULL) {
+        printf("memory allocation for event list failed.");
+        exit(EXIT_FAILURE);
+      }
     }
+    p->seq = h->seq++;
+    h->ev[h->len] = p;
+    siftup(h, h->len++);
   }
+  INSTR_GAUGE(INSTR_EVLIST_DEPTH, h->len);
+  INSTR_STOP(INSTR_INSERTEVENT, t0);
+}
+
+void insertevent(struct event *p)
+{
+  p->next = NULL;
+  insertrun(curheap, p);
 }
 
-void generate_next_arrival(void)
+void generate_next_arrival(int flow)
 {
   double x;
   struct event *evptr;
+  int size = 0;
 
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  if (traffic_specs > 0) {  /* the flow's traffic source says when */
+    x = traffic_next(&flows[flow].traffic, jimsrand, &size);
+    if (x == TRAFFIC_END) {
+      if (TRACE>2)
+        printf("          GENERATE NEXT ARRIVAL: the traffic source has ended\n");
+      return;
+    }
   }
-  evptr->evtime =  time + x;
+  else
+    x = time + lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  /* having mean of lambda        */
+  evptr = allocevent();
+  evptr->evtime =  x;
   evptr->evtype =  FROM_LAYER5;
+  evptr->flow = flow;
+  evptr->msgsize = size;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
   else
@@ -167,19 +516,17 @@ void generate_next_arrival(void)
 
 void printevlist(void)
 {
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  int i;
+  printf("--------------\nEvent List Follows (in heap order):\n");
+  for (i = 0; i < evlist.len; i++) {
+    printf("Event time: %f, type: %d entity: %d flow: %d\n",evlist.ev[i]->evtime,
+           evlist.ev[i]->evtype,evlist.ev[i]->eventity,evlist.ev[i]->flow);
   }
   printf("--------------\n");
 }
 
-void init(void)                         /* initialize the simulator */
+static void readparams(void)            /* read the simulation parameters */
 {
-  float sum, avg;
-  int i;
-
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
   scanf("%d",&nsimmax);
@@ -195,9 +542,15 @@ void init(void)                         /* initialize the simulator */
   scanf("%f",&lambda);
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+}
 
+static void reset(unsigned int seed)    /* start a run from time 0 */
+{
+  struct event *evptr;
+  float sum, avg;
+  int i;
 
-  srand(9999);              /* init random number generator */
+  srand(seed);              /* init random number generator */
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -215,18 +568,104 @@ void init(void)                         /* initialize the simulator */
   packets_resent = 0;
   new_ACKs = 0;
   packets_received = 0;
+  rcvbuf_now = 0;
+  rcvbuf_max = 0;
+  rcvbuf_released = 0;
+  rcvbuf_delay = 0.0;
+  nacks_sent = 0;
+  packets_resent_nack = 0;
+  recoveries = 0;
+  queuedpkts = 0;
+  queuedelay = 0.0;
+  recoverysum = 0.0;
   packets_lost = 0;  
   packets_corrupt = 0;
+  packets_reordered = 0;
+  packets_overtaken = 0;
+  packets_duplicated = 0;
   packets_sent = 0;
   packets_timeout = 0;
   messages_delivered = 0;
+  bytes_delivered = 0;
 
   ntolayer3 = 0;
   nlost = 0;
   ncorrupt = 0;
+  nsim = 0;
+
+  warmup_time = 0.0;
+  warmup_resent = 0;
+  lastdelivery = 0.0;
+  latencysum = 0.0;
+  for (i = 0; i < nflows; i++) {
+    flows[i].nsim = 0;
+    flows[i].delivered = 0;
+    flows[i].bytes = 0;
+    flows[i].latencysum = 0.0;
+    flows[i].resent = 0;
+    flows[i].dropped = 0;
+    flows[i].held = 0;
+    flows[i].rcvsince = flows[i].rcvarea = 0.0;
+    flows[i].rcvmax = 0;
+    flows[i].timer[A] = flows[i].timer[B] = NULL;
+    flows[i].sendhead = flows[i].sendtail = 0;
+    memset(&flows[i].counted, 0, sizeof(struct counters));
+    flows[i].now = 0.0;
+    flows[i].sends = 0;
+    verify_reset(&flows[i].verifier);
+  }
+  while (evlist.len > 0) {       /* left over by a run that stopped early */
+    evptr = evlist.ev[--evlist.len];
+    if (evptr->pktptr != NULL)
+      pkt_release(&evptr->pkt);
+    freeevent(evptr);
+  }
+  lastarrival[A] = lastarrival[B] = 0.0;
+  nheld[A] = nheld[B] = 0;
+  stop_reset();
+  path_reset();
+  if (lpmode) {
+    for (i = 0; i < nflows; i++)
+      seedstream(flows[i].rng, seed, i);
+    seedstream(chanrng, seed, nflows);
+    stream = chanrng;
+  }
+  resetsampling();
 
   time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  for (i = 0; i < nflows; i++) {
+    setflow(i);
+    if (traffic_specs > 0)
+      traffic_start(&flows[i].traffic, i, nflows, lambda, time, jimsrand);
+    generate_next_arrival(i);  /* initialize event list */
+  }
+  setflow(0);
+}
+
+/* remember when a message accepted by layer 4 arrived from layer 5.
+   Deliveries are matched to these in order, which is exact for
+   protocols that deliver in order. */
+static void noteaccepted(struct flow *f)
+{
+  int i;
+
+  if (f->sendtail == f->sendcap) {
+    if (f->sendhead > 0) {       /* slide down to make room */
+      for (i = f->sendhead; i < f->sendtail; i++)
+        f->sendtimes[i - f->sendhead] = f->sendtimes[i];
+      f->sendtail -= f->sendhead;
+      f->sendhead = 0;
+    }
+    else {
+      f->sendcap = f->sendcap ? 2 * f->sendcap : 64;
+      f->sendtimes = realloc(f->sendtimes, f->sendcap * sizeof(float));
+      if (f->sendtimes == NULL) {
+        printf("memory allocation for send times failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  f->sendtimes[f->sendtail++] = time;
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -235,30 +674,17 @@ void init(void)                         /* initialize the simulator */
 void stoptimer(int AorB)
 /* A or B is trying to stop timer */
 {
-  struct event *q;
+  struct event *q = flows[curflow].timer[AorB];
 
   if (TRACE>1)
     printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+  if (q == NULL) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  removeevent(curheap, q);
+  freeevent(q);
+  flows[curflow].timer[AorB] = NULL;
 }
 
 
@@ -266,100 +692,209 @@ void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-  struct event *q;
   struct event *evptr;
 
   if (TRACE>1)
     printf("          START TIMER: starting timer at %f\n",time);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (flows[curflow].timer[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = allocevent();
   evptr->evtime =  time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
   insertevent(evptr);
+  flows[curflow].timer[AorB] = evptr;
 } 
 
+void startpacetimer(int AorB, double increment, struct pacer *pacer)
+/* the pacer of A or B wants to send again after increment */
+{
+  struct event *evptr;
+
+  evptr = allocevent();
+  evptr->evtime =  time + increment;
+  evptr->evtype =  PACE_RELEASE;
+  evptr->eventity = AorB;
+  evptr->pacer = pacer;
+  insertevent(evptr);
+}
+
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+/* move an arrival forward to time at, on the event list or still in
+   the run tolayer3_batch() is building */
+static void retime(struct event *evptr, float at)
+{
+  if (evptr->heapidx >= 0 && evptr->heapidx < evlist.len && evlist.ev[evptr->heapidx] == evptr) {
+    removeevent(&evlist, evptr);
+    evptr->evtime = at;
+    insertevent(evptr);
+  }
+  else
+    evptr->evtime = at;
+}
+
+/* a packet sent by AorB arrives at time at, ahead of the ones held back
+   that would arrive later: each of those counts it, and one that has
+   now been overtaken as often as it was to be arrives just after it */
+static void overtake(int AorB, float at)
+{
+  struct heldpkt *h = held[AorB];
+  int i, n = 0;
+
+  for (i = 0; i < nheld[AorB]; i++) {
+    if (h[i].due <= at)         /* gets there first, or is there already */
+      continue;
+    packets_overtaken++;
+    if (--h[i].left == 0) {
+      retime(h[i].ev, at);      /* a tie goes to the packet inserted last */
+      continue;
+    }
+    h[n++] = h[i];
+  }
+  nheld[AorB] = n;
+}
+
+/* schedule the arrival of a packet sent by AorB over the single-hop
+   medium, behind the packets already on their way.  With --reorder it
+   may be held back instead, for up to reorderdepth later packets to
+   overtake; if they are slow in coming it arrives anyway by the time
+   they would have, had they been sent at once.  Only a packet sent,
+   not a duplicate, counts toward the queueing delay */
+static void schedule(int AorB, struct event *evptr, int sent)
 {
+  int to = (AorB+1) % 2;
+  float lastime;
+  int k;
+
+  lastime = lastarrival[to] > time ? lastarrival[to] : time;
+  if (AorB == A && sent)          /* time spent queued behind earlier packets */
+    queuedelay += lastime - time;
+  evptr->evtime =  lastime + 1 + 9*jimsrand();
+  if (reorderprob[AorB] > 0.0) {
+    if (nheld[AorB] < REORDER_MAXDEPTH && jimsrand() < reorderprob[AorB]) {
+      k = 1 + (int)(jimsrand() * reorderdepth[AorB]);
+      if (k > reorderdepth[AorB])
+        k = reorderdepth[AorB];
+      evptr->evtime += 10 * k;
+      held[AorB][nheld[AorB]].ev = evptr;
+      held[AorB][nheld[AorB]].due = evptr->evtime;
+      held[AorB][nheld[AorB]++].left = k;
+      packets_reordered++;
+      if (TRACE>0)
+        printf("          TOLAYER3: packet being held back for %d later packets\n", k);
+      return;
+    }
+    overtake(AorB, evptr->evtime);
+  }
+  lastarrival[to] = evptr->evtime;
+}
+
+/* with --duplicate, a second copy of the packet whose arrival is evptr,
+   arriving as the next packet sent.  Linked to evptr by next */
+static void duplicate(int AorB, struct event *evptr)
+{
+  struct event *dup = allocevent();
+
+  dup->evtype = evptr->evtype;
+  dup->eventity = evptr->eventity;
+  dup->pkt = evptr->pkt;
+  dup->pktptr = &dup->pkt;
+  if (dup->pkt.buf != NULL)
+    pbuf_ref(dup->pkt.buf);
+  dup->step = 0;
+  dup->next = NULL;
+  schedule(AorB, dup, 0);
+  evptr->next = dup;
+  packets_duplicated++;
+  if (TRACE>0)
+    printf("          TOLAYER3: packet being duplicated\n");
+}
+
+/* put a packet sent by AorB into the medium.  Returns the event of its
+   arrival at the other side (or at the first router of the path),
+   followed by next by that of a duplicate, or NULL if it is lost */
+static struct event *transmit(int AorB, const struct pkt *packet)
+{
+  struct event *evptr;
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
+  struct pbuf *copy;
+  float x;
   int i;
 
   ntolayer3++;
+  packets_sent++;
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (packetlost(AorB)) {
     nlost++;
+    packets_lost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
-    return;
+    return NULL;
   }  
 
   /* make a copy of the packet student just gave me since he/she may decide */
   /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
+  evptr = allocevent();
+  evptr->next = NULL;
+  mypktptr = &evptr->pkt;
+  *mypktptr = *packet;
+  if (mypktptr->buf != NULL)
+    pbuf_ref(mypktptr->buf);      /* the payload bytes are shared, not copied */
   if (TRACE>2)  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
+    if (mypktptr->buf != NULL)
+      printf("%d bytes at %d of %d", mypktptr->length, mypktptr->offset, mypktptr->msglen);
+    else
+      for (i=0; i<20; i++)
+        printf("%c",mypktptr->payload[i]);
     printf("\n");
   }
 
   /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
   evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
-
+  if (AorB == A)
+    queuedpkts++;
+  if (path_hops > 0) {            /* out over the first link of the path */
+    evptr->step = 0;
+    if (!hopforward(evptr)) {
+      if (mypktptr->buf != NULL)
+        pbuf_unref(mypktptr->buf);
+      freeevent(evptr);
+      return NULL;
+    }
+  }
+  else
+    /* medium does not reorder (unless --reorder), so each packet arrives
+       between 1 and 10 time units after the one before it on the way to
+       the same destination, whichever flow sent it. */
+    schedule(AorB, evptr, 1);
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (packetcorrupted(AorB)) {
     ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
+    packets_corrupt++;
+    if ( (x = jimsrand()) < .75) {
+      if (mypktptr->buf != NULL) {  /* corrupt a private copy of the bytes */
+        copy = pbuf_copy(mypktptr->buf);
+        pbuf_unref(mypktptr->buf);
+        copy->data[mypktptr->offset] = 'Z';
+        mypktptr->buf = copy;
+      }
+      else
+        mypktptr->payload[0]='Z';   /* corrupt payload */
+    }
     else if (x < .875)
       mypktptr->seqnum = 999999;
     else
@@ -368,12 +903,160 @@ void tolayer3(int AorB, struct pkt packet)
       printf("          TOLAYER3: packet being corrupted\n");
   }  
 
+  if (dupprob[AorB] > 0.0 && jimsrand() < dupprob[AorB])
+    duplicate(AorB, evptr);
+
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  return evptr;
+}
+
+/* with --threads a flow's packets wait in its thread's outbox for the
+   channel, which takes them at the end of the time window */
+struct sendrec {
+  float time;               /* time the packet was sent */
+  int flow;
+  unsigned long seq;        /* order of the flow's packets sent at that time */
+  int AorB;
+  struct pkt pkt;           /* holds its own buffer reference */
+};
+
+struct outbox {
+  struct sendrec *rec;
+  int len, cap;
+};
+
+static struct outbox *outboxes = NULL;  /* one per thread */
+static int noutboxes = 0;
+static __thread int curthread = 0;      /* thread handling the events */
+
+static void post(int AorB, const struct pkt packets[], int n)
+{
+  struct outbox *o = &outboxes[curthread];
+  struct sendrec *r;
+  int k;
+
+  for (k = 0; k < n; k++) {
+    if (o->len == o->cap) {
+      o->cap = o->cap ? 2 * o->cap : 256;
+      o->rec = realloc(o->rec, o->cap * sizeof(struct sendrec));
+      if (o->rec == NULL) {
+        printf("memory allocation for an outbox failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    r = &o->rec[o->len++];
+    r->time = time;
+    r->flow = curflow;
+    r->seq = flows[curflow].sends++;
+    r->AorB = AorB;
+    r->pkt = packets[k];
+    if (r->pkt.buf != NULL)
+      pbuf_ref(r->pkt.buf);
+  }
+}
+
+void tolayer3_batch(int AorB, const struct pkt packets[], int n)
+/* A or B is sending n packets to network in one go */
+{
+  struct event *evptr,*run,*last;
+  int k;
+  INSTR_START(t0);
+
+  if (lpmode) {
+    post(AorB, packets, n);
+    return;
+  }
+  reserveevents(n);   /* one refill at most for the whole batch */
+  run = last = NULL;
+  for (k = 0; k < n; k++) {
+    if ((evptr = transmit(AorB, &packets[k])) == NULL)
+      continue;
+    if (last == NULL)
+      run = evptr;
+    else
+      last->next = evptr;
+    for (last = evptr; last->next != NULL; last = last->next)
+      ;                             /* its duplicate, if any */
+  }
+  if (run != NULL)
+    insertrun(curheap, run);
+  INSTR_STOP(INSTR_TOLAYER3, t0);
+}
+
+void tolayer3_ref(int AorB, const struct pkt *packet)
+/* A or B is sending to network  */
+{
+  tolayer3_batch(AorB, packet, 1);
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  packet.length = packet.offset = packet.msglen = 0;   /* always classic */
+  packet.buf = NULL;
+  tolayer3_batch(AorB, &packet, 1);
 } 
 
-void tolayer5(int AorB, char datasent[20])
+double get_sim_time(void)
+{
+  return time;
+}
+
+void rcvbuf_occupancy(int held)
+{
+  struct flow *f = &flows[curflow];
+
+  f->rcvarea += f->held * (time - f->rcvsince);
+  f->rcvsince = time;
+  if (!lpmode) {                  /* all flows together */
+    rcvbuf_now += held - f->held;
+    if (rcvbuf_now > rcvbuf_max)
+      rcvbuf_max = rcvbuf_now;
+  }
+  f->held = held;
+  if (held > f->rcvmax)
+    f->rcvmax = held;
+}
+
+void rcvbuf_release(double arrived)
+{
+  rcvbuf_released++;
+  rcvbuf_delay += time - arrived;
+}
+
+void loss_recovered(double missed)
+{
+  recoveries++;
+  recoverysum += time - missed;
+}
+
+/* account for a message handed to layer 5 */
+static void delivered(int nbytes)
+{
+  struct flow *f = &flows[curflow];
+  double latency = -1.0;
+
+  messages_delivered++;
+  bytes_delivered += nbytes;
+  f->delivered++;
+  f->bytes += nbytes;
+  lastdelivery = time;
+  if (messages_delivered == warmup) {
+    warmup_time = time;
+    warmup_resent = packets_resent;
+  }
+  if (f->sendhead < f->sendtail) {
+    latency = time - f->sendtimes[f->sendhead];
+    if (messages_delivered > warmup)
+      latencysum += latency;
+    f->latencysum += latency;
+    f->sendhead++;
+  }
+  if (ondelivery != NULL)
+    ondelivery(ondeliveryarg, curflow, time, nbytes, latency);
+}
+
+void tolayer5(int AorB, const char datasent[20])
 {
   int i;  
   if (TRACE>2) {
@@ -386,93 +1069,1179 @@ void tolayer5(int AorB, char datasent[20])
       printf("%c",datasent[i]);
     printf("\n");
   }
-  messages_delivered++;
+  if (verify && AorB == B)
+    verify_delivered(&flows[curflow].verifier, datasent, 20);
+  delivered(20);
 }
 
-int main(void)
+void tolayer5_buf(int AorB, const struct pbuf *buf, int length)
 {
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
-      }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
-    }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
-    }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
+  if (TRACE>2)
+    printf("          TOLAYER5: %d bytes (%c...) received by application at %c\n",
+           length, buf->data[0], AorB == A ? 'A' : 'B');
+  if (verify && AorB == B)
+    verify_delivered(&flows[curflow].verifier, buf->data, length);
+  delivered(length);
+}
+
+/* value of a "--name=value" option, or NULL if arg is not that option */
+static const char *optval(const char *arg, const char *name)
+{
+  size_t n = strlen(name);
+
+  if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+    return arg + n + 1;
+  return NULL;
+}
+
+/* apply a branch's parameter overrides, e.g. "lossprob=0.3,seed=7" */
+static void applybranch(const char *spec)
+{
+  char buf[256];
+  char *item, *val;
+
+  strncpy(buf, spec, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (item = strtok(buf, ","); item != NULL; item = strtok(NULL, ",")) {
+    val = strchr(item, '=');
+    if (val == NULL) {
+      printf("bad branch parameter: %s\n", item);
+      exit(EXIT_FAILURE);
+    }
+    *val++ = '\0';
+    if (strcmp(item, "lossprob") == 0)
+      lossprob = atof(val);
+    else if (strcmp(item, "corruptprob") == 0)
+      corruptprob = atof(val);
+    else if (strcmp(item, "corruptdirection") == 0)
+      corruptdirection = atoi(val);
+    else if (strcmp(item, "lambda") == 0)
+      lambda = atof(val);
+    else if (strcmp(item, "nsimmax") == 0)
+      nsimmax = atoi(val);
+    else if (strcmp(item, "trace") == 0)
+      TRACE = atoi(val);
+    else if (strcmp(item, "seed") == 0)
+      srand(atoi(val));
+    else {
+      printf("unknown branch parameter: %s\n", item);
+      exit(EXIT_FAILURE);
     }
-    free(eventptr);
   }
+  resetsampling();
+}
+
+static int nackselftest(void);
 
- terminate:
+/* apply a command line option, given before the interactive parameters;
+   return 0 if there is no such option */
+static int option(const char *arg)
+{
+  const char *v;
+  float p;
+  int depth, dir;
+
+  if (strcmp(arg, "--instrument") == 0)
+    instrument = 1;
+  else if ((v = optval(arg, "--checkpoint-time")) != NULL)
+    checkpoint_time = atof(v);
+  else if ((v = optval(arg, "--checkpoint-msgs")) != NULL)
+    checkpoint_msgs = atoi(v);
+  else if ((v = optval(arg, "--branch")) != NULL)
+    checkpoint_add_branch(v);
+  else if ((v = optval(arg, "--replicate")) != NULL)
+    replicate_max = atoi(v);
+  else if ((v = optval(arg, "--precision")) != NULL)
+    replicate_precision = atof(v);
+  else if ((v = optval(arg, "--jobs")) != NULL)
+    replicate_jobs = atoi(v);
+  else if ((v = optval(arg, "--warmup")) != NULL)
+    warmup = atoi(v);
+  else if ((v = optval(arg, "--sampling")) != NULL) {
+    if (strcmp(v, "geometric") == 0)
+      sampling = SAMPLE_GEOMETRIC;
+    else if (strcmp(v, "bernoulli") == 0)
+      sampling = SAMPLE_BERNOULLI;
+    else {
+      printf("unknown sampling mode: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--hop")) != NULL) {
+    if (!path_add(v)) {
+      printf("bad link (RATE:DELAY[:QUEUE[:LOSS]], at most %d): %s\n", PATH_MAXHOPS, v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--protocol")) != NULL) {
+    if (!protocol_add(v)) {
+      printf("unknown protocol, or more than %d given: %s; linked in:", PROTOCOL_MAXSPECS, v);
+      protocol_names();
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--reorder")) != NULL) {
+    depth = 3;
+    dir = 2;
+    if (sscanf(v, "%f:%d:%d", &p, &depth, &dir) < 1 || p < 0.0 || p > 1.0 ||
+        depth < 1 || depth > REORDER_MAXDEPTH || dir < 0 || dir > 2) {
+      printf("bad reordering (P[:DEPTH[:DIRECTION]], DEPTH at most %d): %s\n", REORDER_MAXDEPTH, v);
+      exit(EXIT_FAILURE);
+    }
+    if (dir != B) {             /* packets A sends */
+      reorderprob[A] = p;
+      reorderdepth[A] = depth;
+    }
+    if (dir != A) {
+      reorderprob[B] = p;
+      reorderdepth[B] = depth;
+    }
+  }
+  else if ((v = optval(arg, "--duplicate")) != NULL) {
+    dir = 2;
+    if (sscanf(v, "%f:%d", &p, &dir) < 1 || p < 0.0 || p > 1.0 || dir < 0 || dir > 2) {
+      printf("bad duplication (P[:DIRECTION]): %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    if (dir != B)
+      dupprob[A] = p;
+    if (dir != A)
+      dupprob[B] = p;
+  }
+  else if ((v = optval(arg, "--traffic")) != NULL) {
+    if (!traffic_add(v)) {
+      printf("bad traffic source (uniform, poisson, cbr, onoff:ON:OFF, pareto:ALPHA, trace:FILE, "
+             "joined by +, at most %d): %s\n", TRAFFIC_MAXSPECS, v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--until")) != NULL) {
+    if ((stop_time = atof(v)) <= 0.0) {
+      printf("bad time horizon: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    stop_any = 1;
+  }
+  else if ((v = optval(arg, "--stop-msgs")) != NULL) {
+    if ((stop_msgs = atoll(v)) <= 0) {
+      printf("bad message target: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    stop_any = 1;
+  }
+  else if ((v = optval(arg, "--stop-bytes")) != NULL) {
+    if ((stop_bytes = atoll(v)) <= 0) {
+      printf("bad byte target: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    stop_any = 1;
+  }
+  else if ((v = optval(arg, "--steady")) != NULL) {
+    if (sscanf(v, "%lf:%lf", &stop_steady, &stop_block) < 1 || stop_steady <= 0.0 || stop_block <= 0.0) {
+      printf("bad steady-state test (REL[:BLOCK]): %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    stop_any = 1;
+  }
+  else if ((v = optval(arg, "--budget")) != NULL) {
+    if ((stop_budget = atof(v)) <= 0.0) {
+      printf("bad wall-clock budget: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+    stop_any = 1;
+  }
+  else if ((v = optval(arg, "--flows")) != NULL) {
+    nflows = atoi(v);
+    if (nflows < 1) {
+      printf("bad number of flows: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--threads")) != NULL) {
+    parallel_threads = atoi(v);
+    if (parallel_threads < 1) {
+      printf("bad number of threads: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if (strcmp(arg, "--nack") == 0)
+    nack = 1;
+  else if ((v = optval(arg, "--fec")) != NULL) {
+    fec_k = atoi(v);
+    if (fec_k < 0 || fec_k > FEC_MAXK) {
+      printf("bad FEC group size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--pace")) != NULL) {
+    if (strcmp(v, "auto") == 0)
+      pace_auto = 1;
+    else if ((pace_rate = atof(v)) <= 0.0) {
+      printf("bad pacing rate: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--pace-burst")) != NULL) {
+    pace_burst = atoi(v);
+    if (pace_burst < 1) {
+      printf("bad pacing burst: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--msgsize")) != NULL) {
+    if (sscanf(v, "%d-%d", &msgsize_min, &msgsize_max) != 2)
+      msgsize_max = msgsize_min;
+    if (msgsize_min < 1 || msgsize_max < msgsize_min) {
+      printf("bad message size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--mss")) != NULL) {
+    payload_mss = atoi(v);
+    if (payload_mss < 1) {
+      printf("bad segment size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--checksum")) != NULL) {
+    if (!checksum_select(v)) {
+      printf("unknown checksum engine: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if (strcmp(arg, "--check-checksum") == 0) {
+    srand(9999);
+    exit(checksum_selftest(jimsrand) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  else if (strcmp(arg, "--check-sampling") == 0) {
+    srand(9999);
+    exit(sampling_selftest(jimsrand) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  else if (strcmp(arg, "--check-traffic") == 0) {
+    srand(9999);
+    exit(traffic_selftest(jimsrand) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  else if (strcmp(arg, "--verify") == 0)
+    verify = 1;
+  else if (strcmp(arg, "--check-verify") == 0)
+    exit(verify_selftest() ? EXIT_FAILURE : EXIT_SUCCESS);
+  else if (strcmp(arg, "--check-nack") == 0)
+    exit(nackselftest() ? EXIT_FAILURE : EXIT_SUCCESS);
+  else
+    return 0;
+  return 1;
+}
+
+/* handle an event taken off the event list, for the flow it belongs to */
+static void dispatch(struct event *eventptr)
+{
+  struct msg  msg2give;
+  struct flow *f = &flows[curflow];
+   
+  int i,j,dropped,resent,full,forwarded;
+  unsigned int hash = 0;
+
+  if (eventptr->evtype == TIMER_INTERRUPT)
+    f->timer[eventptr->eventity] = NULL;
+  if (onevent != NULL)
+    onevent(oneventarg, eventptr->evtime, eventptr->evtype, eventptr->eventity, curflow);
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",eventptr->evtime);
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else if (eventptr->evtype==PACE_RELEASE)
+      printf(", pacerelease ");
+    else if (eventptr->evtype==FROM_HOP)
+      printf(", fromhop %d ", eventptr->step);
+    else
+      printf(", fromlayer3 ");
+    printf(" entity: %d",eventptr->eventity);
+    if (nflows > 1)
+      printf(" flow: %d",curflow);
+    printf("\n");
+  }
+  time = eventptr->evtime;        /* update time to next event time */
+  resent = packets_resent;
+  full = window_full;
+  forwarded = 0;
+  {
+  INSTR_START(tev);
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (f->nsim < nsimmax) {
+      generate_next_arrival(curflow);   /* set up future arrival */
+      /* fill in msg to give with string of same letter */    
+      j = f->nsim % 26; 
+      for (i=0; i<20; i++)  
+        msg2give.data[i] = 97 + j;
+      if (verify && eventptr->eventity == A)    /* tag it with its id */
+        hash = verify_stamp(&f->verifier, msg2give.data, 20);
+      if (TRACE>2) {
+        printf("          MAINLOOP: data given to student: ");
+        for (i=0; i<20; i++) 
+          printf("%c", msg2give.data[i]);
+        printf("\n");
+      }
+      msg2give.length = 20;
+      msg2give.buf = NULL;
+      if (eventptr->msgsize > 0 || msgsize_max > 0) {   /* message bytes go in a shared buffer */
+        if (eventptr->msgsize > 0)
+          msg2give.length = eventptr->msgsize;   /* as the traffic source has it */
+        else {
+          msg2give.length = msgsize_min + (int)(jimsrand() * (msgsize_max - msgsize_min + 1));
+          if (msg2give.length > msgsize_max)
+            msg2give.length = msgsize_max;
+        }
+        msg2give.buf = pbuf_alloc(msg2give.length);
+        memset(msg2give.buf->data, 97 + j, msg2give.length);
+        if (verify && eventptr->eventity == A)
+          hash = verify_stamp(&f->verifier, msg2give.buf->data, msg2give.length);
+      }
+      nsim++;
+      f->nsim++;
+      if (eventptr->eventity == A) {
+        INSTR_START(tcb);
+        dropped = window_full;
+        f->proto->A_output(&msg2give);  
+        if (window_full == dropped) {
+          noteaccepted(f);
+          if (verify)
+            verify_accepted(&f->verifier, hash);
+        }
+        INSTR_STOP(INSTR_A_OUTPUT, tcb);
+      }
+      else
+        f->proto->B_output(msg2give);  
+      if (msg2give.buf != NULL)    /* layer 4 holds its own references */
+        pbuf_unref(msg2give.buf);
+    }
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    /* the protocol gets a view of the emulator's copy, not a copy */
+    if (eventptr->eventity ==A) {    /* deliver packet by calling */
+      INSTR_START(tcb);
+      f->proto->A_input(eventptr->pktptr);  /* appropriate entity */
+      INSTR_STOP(INSTR_A_INPUT, tcb);
+    }
+    else {
+      INSTR_START(tcb);
+      f->proto->B_input(eventptr->pktptr);
+      INSTR_STOP(INSTR_B_INPUT, tcb);
+    }
+    if (eventptr->pkt.buf != NULL)
+      pbuf_unref(eventptr->pkt.buf);
+  }
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    packets_timeout++;
+    if (eventptr->eventity == A) {
+      INSTR_START(tcb);
+      f->proto->A_timerinterrupt();
+      INSTR_STOP(INSTR_A_TIMERINTERRUPT, tcb);
+    }
+    else
+      f->proto->B_timerinterrupt();
+  }
+  else if (eventptr->evtype ==  PACE_RELEASE)
+    pace_release(eventptr->pacer, eventptr->eventity);
+  else if (eventptr->evtype ==  FROM_HOP) {
+    /* store and forward: on to the next link, the event goes along */
+    if (hopforward(eventptr)) {
+      insertevent(eventptr);
+      forwarded = 1;
+    }
+    else if (eventptr->pkt.buf != NULL)
+      pbuf_unref(eventptr->pkt.buf);
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  INSTR_STOP(eventptr->evtype == TIMER_INTERRUPT || eventptr->evtype == PACE_RELEASE ? INSTR_EV_TIMER :
+             eventptr->evtype == FROM_LAYER5 ? INSTR_EV_LAYER5 : INSTR_EV_LAYER3, tev);
+  }
+  f->resent += packets_resent - resent;
+  f->dropped += window_full - full;
+  if (!forwarded)
+    freeevent(eventptr);
+}
+
+/* handle the next event; return 0 if no events are left or a stop
+   condition ends the run */
+static int step(void)
+{
+  struct event *eventptr;
+  const char *branch;
+
+  if (evlist.len == 0)
+    return 0;
+  eventptr = evlist.ev[0];      /* get next event to simulate */
+  if (stop_any && stop_check(eventptr->evtime, messages_delivered, bytes_delivered)) {
+    if (stop_time >= 0.0 && eventptr->evtime >= stop_time)
+      time = stop_time;         /* the run covered the whole horizon */
+    return 0;
+  }
+  if (checkpoint_due(eventptr->evtime, nsim)) {
+    branch = checkpoint_fork();   /* children continue with the branch */
+    if (branch != NULL)
+      applybranch(branch);
+  }
+  removeevent(&evlist, eventptr);   /* remove this event from event list */
+  setflow(eventptr->flow);      /* the protocol acts for its flow */
+  bindflow(curflow);
+  dispatch(eventptr);
+  return 1;
+}
+
+/* run the event loop until no events are left */
+static void simulate(void)
+{
+  while (step())
+    ;
+}
+
+/******************* THE FLOWS AS LOGICAL PROCESSES *****************/
+/* With --threads each flow is a logical process (parallel.h): its     */
+/* events go on a list of its own and it runs on one of the threads.   */
+/* The flows only meet in the channel, which the packets they send     */
+/* take at least the lookahead to cross; the channel is run on one     */
+/* thread at the end of each time window.                              */
+/***********************************************************************/
+
+static struct evheap hops;        /* packets reaching the path's routers */
+static float hoptime = 0.0;       /* time of the last of those */
+
+#define LOAD(x) x = c->x;
+#define STORE(x) c->x = x;
+#define ADD(x) x += c->x;
+
+/* give the thread the statistics of the flow that runs next */
+static void loadcounters(const struct counters *c)
+{
+  COUNTERS(LOAD)
+  lastdelivery = c->lastdelivery;
+}
+
+static void storecounters(struct counters *c)
+{
+  COUNTERS(STORE)
+  c->lastdelivery = lastdelivery;
+}
+
+/* add a flow's statistics to the thread's */
+static void addcounters(const struct counters *c)
+{
+  COUNTERS(ADD)
+  if (c->lastdelivery > lastdelivery)
+    lastdelivery = c->lastdelivery;
+}
+
+/* run flow lp's events before until on the given thread, return the
+   time of the next one */
+static double advance(int lp, double until, int thread)
+{
+  struct flow *f = &flows[lp];
+  struct event *eventptr;
+
+  if (stop_time >= 0.0 && until > stop_time)
+    until = stop_time;            /* nothing at or after the horizon runs */
+  curthread = thread;
+  setflow(lp);
+  bindflow(lp);
+  loadcounters(&f->counted);
+  while (f->events.len > 0 && (eventptr = f->events.ev[0])->evtime < until) {
+    removeevent(&f->events, eventptr);
+    dispatch(eventptr);
+    f->now = time;
+  }
+  storecounters(&f->counted);
+  return f->events.len > 0 ? f->events.ev[0]->evtime : PAR_NEVER;
+}
+
+/* put an event the channel made on the list it goes on, return its time */
+static double place(struct event *evptr)
+{
+  struct flow *f = &flows[evptr->flow];
+
+  evptr->next = NULL;
+  if (evptr->evtype == FROM_HOP)
+    insertrun(&hops, evptr);
+  else {
+    if (evptr->evtime < f->now)    /* float rounding, never more */
+      evptr->evtime = f->now;
+    insertrun(&f->events, evptr);
+  }
+  return evptr->evtime;
+}
+
+/* packets sent earlier go first, then by flow and in the order sent */
+static int sendbefore(const void *a, const void *b)
+{
+  const struct sendrec *p = *(const struct sendrec * const *)a;
+  const struct sendrec *q = *(const struct sendrec * const *)b;
+
+  if (p->time != q->time)
+    return p->time < q->time ? -1 : 1;
+  if (p->flow != q->flow)
+    return p->flow < q->flow ? -1 : 1;
+  return p->seq < q->seq ? -1 : p->seq > q->seq;
+}
+
+/* the channel's part of a window: the packets the flows sent and those
+   reaching a router before until, in time order.  Returns the time of
+   the earliest event this left */
+static double exchange(double until)
+{
+  static struct sendrec **sends = NULL;
+  static int sendcap = 0;
+  struct event *evptr;
+  struct sendrec *r;
+  double t, next = PAR_NEVER;
+  int i, k, n;
+
+  if (stop_time >= 0.0 && until > stop_time)
+    until = stop_time;
+  for (i = 0, n = 0; i < noutboxes; i++)
+    n += outboxes[i].len;
+  if (n > sendcap) {
+    sendcap = n;
+    sends = realloc(sends, sendcap * sizeof(struct sendrec *));
+    if (sends == NULL) {
+      printf("memory allocation for the channel failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0, n = 0; i < noutboxes; i++)
+    for (k = 0; k < outboxes[i].len; k++)
+      sends[n++] = &outboxes[i].rec[k];
+  qsort(sends, n, sizeof(struct sendrec *), sendbefore);
+
+  k = 0;
+  while (1) {
+    evptr = hops.len > 0 && hops.ev[0]->evtime < until ? hops.ev[0] : NULL;
+    if (evptr != NULL && (k == n || evptr->evtime <= sends[k]->time)) {
+      removeevent(&hops, evptr);
+      time = hoptime = evptr->evtime;
+      setflow(evptr->flow);
+      stream = chanrng;
+      if (!hopforward(evptr)) {
+        pkt_release(&evptr->pkt);
+        freeevent(evptr);
+      }
+      else if ((t = place(evptr)) < next)
+        next = t;
+    }
+    else if (k < n) {
+      r = sends[k++];
+      time = r->time;
+      setflow(r->flow);
+      stream = chanrng;
+      if ((evptr = transmit(r->AorB, &r->pkt)) != NULL && (t = place(evptr)) < next)
+        next = t;
+      pkt_release(&r->pkt);
+    }
+    else
+      break;
+  }
+  for (i = 0; i < noutboxes; i++)
+    outboxes[i].len = 0;
+  if (hops.len > 0 && hops.ev[0]->evtime < next)
+    next = hops.ev[0]->evtime;
+  return next;
+}
+
+static double stopnext;           /* start of the window the run stopped before */
+
+/* between windows: should the run stop before the next, at time next */
+static int lpstop(double next)
+{
+  long long msgs = 0, bytes = 0;
+  int i;
+
+  if (!stop_any)
+    return 0;
+  stopnext = next;
+  for (i = 0; i < nflows; i++) {
+    msgs += flows[i].delivered;
+    bytes += flows[i].bytes;
+  }
+  return stop_check(next, msgs, bytes);
+}
+
+/* simulate with the flows as logical processes, in windows of the
+   lookahead, on parallel_threads threads or else on this one */
+static void runlps(void)
+{
+  static const struct counters none;
+  struct lpmodel m;
+  double start = PAR_NEVER;
+  int i;
+
+  noutboxes = parallel_threads > 0 ? parallel_threads : 1;
+  outboxes = calloc(noutboxes, sizeof(struct outbox));
+  if (outboxes == NULL) {
+    printf("memory allocation for %d threads failed.", parallel_threads);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nflows; i++)
+    if (flows[i].events.len > 0 && flows[i].events.ev[0]->evtime < start)
+      start = flows[i].events.ev[0]->evtime;
+  m.nlps = nflows;
+  m.lookahead = path_hops > 0 ? path_lookahead() : 1.0;  /* quickest a packet crosses */
+  m.advance = advance;
+  m.exchange = exchange;
+  m.stop = lpstop;
+  parallel_run(&m, start);
+
+  /* the totals, added up in flow order whatever the threads did */
+  loadcounters(&none);
+  time = hoptime;
+  for (i = 0; i < nflows; i++) {
+    addcounters(&flows[i].counted);
+    if (flows[i].now > time)
+      time = flows[i].now;
+  }
+  if (stop_reason != NULL && stop_time >= 0.0 && stopnext >= stop_time)
+    time = stop_time;             /* the run covered the whole horizon */
+}
+
+/* each flow's share of the channel, and how fair the sharing was */
+static void flowreport(void)
+{
+  double x, sum = 0.0, sumsq = 0.0, min = 0.0, max = 0.0;
+  char label[64] = "";
+  int i;
+
+  for (i = 0; i < nflows; i++) {
+    x = time > 0.0 ? flows[i].bytes / time : 0.0;
+    if (protocol_specs > 1)     /* flows run different protocols */
+      snprintf(label, sizeof(label), " (%s)", flows[i].proto->name);
+    if (i < FLOWLINES)
+      printf("flow %d%s:  %d messages delivered, goodput %f, latency %f, %d resends, %d dropped \n",
+             i, label, flows[i].delivered, x,
+             flows[i].delivered > 0 ? flows[i].latencysum / flows[i].delivered : 0.0,
+             flows[i].resent, flows[i].dropped);
+    sum += x;
+    sumsq += x * x;
+    if (i == 0 || x < min)
+      min = x;
+    if (i == 0 || x > max)
+      max = x;
+  }
+  if (nflows > FLOWLINES)
+    printf("(%d more flows not shown) \n", nflows - FLOWLINES);
+  printf("goodput per flow:  %f average, %f minimum, %f maximum bytes per time unit \n",
+         sum / nflows, min, max);
+  printf("Jain's fairness index over %d flows:  %f \n", nflows,
+         sumsq > 0.0 ? sum * sum / (nflows * sumsq) : 1.0);
+}
+
+static void report(void)
+{
+  struct flow *f;
+  struct verifycount checked;
+  double rcvarea = 0.0;
+  int i, rcvmax = 0;
+
+  for (i = 0; i < nflows; i++) {   /* receive buffers, up to the end */
+    f = &flows[i];
+    f->rcvarea += f->held * (time - f->rcvsince);
+    f->rcvsince = time;
+    rcvarea += f->rcvarea;
+    if (f->rcvmax > rcvmax)
+      rcvmax = f->rcvmax;
+  }
   printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
+  if (stop_reason != NULL)
+    printf("stopped early:  %s \n", stop_reason);
   printf("number of messages dropped due to full window:  %d \n", window_full);
   printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
   printf("number of packet resends by A:  %d \n", packets_resent);
   printf("number of correct packets received at B:  %d \n", packets_received);
   printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  if (msgsize_max > 0 || fec_k > 0 || traffic_sized) {
+    printf("number of bytes delivered to application:  %lld \n", bytes_delivered);
+    printf("goodput:  %f bytes per time unit \n", lastdelivery > 0.0 ? bytes_delivered / lastdelivery : 0.0);
+  }
+  if (rcvmax > 0) {
+    printf("number of held packets later delivered in order at B:  %d \n", rcvbuf_released);
+    printf("average reordering delay of held packets:  %f \n", rcvbuf_released > 0 ? rcvbuf_delay / rcvbuf_released : 0.0);
+    printf("receive buffer occupancy:  %f average, %d maximum%s \n", time > 0.0 ? rcvarea / time : 0.0,
+           lpmode ? rcvmax : rcvbuf_max, lpmode ? " at one receiver" : "");
+    printf("average message latency:  %f \n", messages_delivered > warmup ? latencysum / (messages_delivered - warmup) : 0.0);
+  }
+  if (recoveries > 0)
+    printf("average loss recovery latency at B:  %f over %d packets \n", recoverysum / recoveries, recoveries);
+  fec_report();
+  pace_report();
+  if (pace_rate > 0.0 || instrument)
+    printf("average queueing delay in the medium A->B:  %f over %d packets \n",
+           queuedpkts > 0 ? queuedelay / queuedpkts : 0.0, queuedpkts);
+  if (nack) {
+    printf("number of NACKs sent by B:  %d \n", nacks_sent);
+    printf("number of packet resends triggered by NACK:  %d, by timeout:  %d \n",
+           packets_resent_nack, packets_resent - packets_resent_nack);
+  }
+  if (reorderprob[A] > 0.0 || reorderprob[B] > 0.0 || dupprob[A] > 0.0 || dupprob[B] > 0.0) {
+    printf("packets lost by layer 3:  %d, corrupted:  %d, reordered:  %d, duplicated:  %d \n",
+           packets_lost, packets_corrupt, packets_reordered, packets_duplicated);
+    printf("average number of later packets overtaking a reordered one:  %f \n",
+           packets_reordered > 0 ? (double)packets_overtaken / packets_reordered : 0.0);
+  }
+  if (verify) {
+    memset(&checked, 0, sizeof(checked));
+    for (i = 0; i < nflows; i++)
+      verify_count(&flows[i].verifier, &checked);
+    verify_report(&checked);
+  }
+  if (path_hops > 0)
+    path_report(time);
+  if (nflows > 1)
+    flowreport();
+  if (instrument) {
+    instr_report();
+    printf("packets sent into layer 3:  %d \n", packets_sent);
+    printf("packets lost by layer 3:  %d \n", packets_lost);
+    printf("packets corrupted by layer 3:  %d \n", packets_corrupt);
+    printf("timer interrupts:  %d \n", packets_timeout);
+  }
+}
+
+/* the per-flow state of the emulator and of the protocol */
+static void allocflows(void)
+{
+  const struct protocol *p;
+  int want = (msgsize_max > 0 ? PROTO_SEGMENTS : 0) | (fec_k > 0 ? PROTO_FEC : 0) |
+             (nack ? PROTO_NACK : 0) | (pace_rate > 0.0 || pace_auto ? PROTO_PACE : 0);
+  int i, j, n;
+
+  flows = calloc(nflows, sizeof(struct flow));
+  if (flows == NULL) {
+    printf("memory allocation for %d flows failed.", nflows);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nflows; i++)
+    flows[i].proto = protocol_of(i);
+  /* each protocol in use keeps a copy of its state for every flow, and
+     must do what the options ask of it */
+  for (i = 0; i < nflows; i++) {
+    p = flows[i].proto;
+    for (j = 0; j < i && flows[j].proto != p; j++)
+      ;
+    if (j < i)
+      continue;               /* seen at an earlier flow */
+    protocol_require(p, want);
+    for (j = i, n = 0; j < nflows; j++)
+      n += flows[j].proto == p;
+    if (p->flows != NULL)
+      p->flows(nflows);
+    else if (n > 1) {
+      printf("protocol %s does not support more than one flow\n", p->name);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* give up the flows, for the next simulation to set up its own.  Their
+   events go to the main pool, as other flows' pools may hold ones it
+   lent them, and this thread goes back to the main list and rand() */
+static void freeflows(void)
+{
+  struct event *evptr;
+  struct flow *f;
+  int i;
+
+  curheap = &evlist;
+  curpool = &evpool;
+  stream = NULL;
+  curflow = 0;
+  if (flows == NULL)
+    return;
+  for (i = 0; i < nflows; i++) {
+    f = &flows[i];
+    while (f->events.len > 0) {
+      evptr = f->events.ev[--f->events.len];
+      if (evptr->pktptr != NULL)
+        pkt_release(&evptr->pkt);
+      freeevent(evptr);
+    }
+    while ((evptr = f->pool.free) != NULL) {
+      f->pool.free = evptr->next;
+      freeevent(evptr);
+    }
+    free(f->events.ev);
+    free(f->sendtimes);
+    free(f->verifier.hash);
+    free(f->verifier.bits);
+  }
+  free(flows);
+  flows = NULL;
+}
+
+/* back to the defaults of every option */
+static void resetoptions(void)
+{
+  instrument = 0;
+  checkpoint_clear();
+  replicate_max = 0;
+  replicate_precision = 0.05;
+  replicate_jobs = 0;
+  warmup = 0;
+  sampling = SAMPLE_BERNOULLI;
+  path_hops = 0;
+  protocol_specs = 0;
+  reorderprob[A] = reorderprob[B] = 0.0;
+  reorderdepth[A] = reorderdepth[B] = 0;
+  dupprob[A] = dupprob[B] = 0.0;
+  traffic_specs = 0;
+  traffic_sized = 0;
+  stop_time = -1.0;
+  stop_msgs = 0;
+  stop_bytes = 0;
+  stop_steady = 0.0;
+  stop_block = 1000.0;
+  stop_budget = 0.0;
+  stop_any = 0;
+  nflows = 1;
+  parallel_threads = 0;
+  lpmode = 0;
+  nack = 0;
+  fec_k = 0;
+  pace_rate = 0.0;
+  pace_auto = 0;
+  pace_burst = 1;
+  msgsize_min = msgsize_max = 0;
+  payload_mss = 1000;
+  checksum_engine = CKSUM_ADDITIVE;
+  verify = 0;
+}
+
+/* A_init() and B_init() for every flow */
+static void initflows(void)
+{
+  int i;
+
+  for (i = 0; i < nflows; i++) {
+    setflow(i);
+    bindflow(i);
+    flows[i].proto->A_init();
+    flows[i].proto->B_init();
+  }
+  setflow(0);
+  bindflow(0);
+}
+
+/* feed sr's B the packets 0 2 4 1 3 with --nack: 1 fills the gap below 2
+   while 4 is still held, which must not set off NACKs for the sequence
+   numbers past the window.  Returns 0 if B asked for 1 and 3 only and
+   delivered all five */
+static int nackselftest(void)
+{
+  static const int order[] = { 0, 2, 4, 1, 3 };
+  struct pkt p;
+  int i, failed;
+
+  printf("-----  sr receiver gaps -------- \n");
+  if (!protocol_add("sr")) {
+    printf("sr is not linked in\n");
+    return 1;
+  }
+  checksum_init();
+  TRACE = 0;
+  nack = 1;
+  lambda = 10.0;
+  allocflows();
+  reset(9999);
+  initflows();
+  for (i = 0; i < 5; i++) {
+    memset(&p, 0, sizeof(p));
+    p.seqnum = order[i];
+    p.acknum = -1;
+    memset(p.payload, 'a' + order[i], 20);
+    p.checksum = pkt_checksum(&p);
+    flows[0].proto->B_input(&p);
+  }
+  printf("packets 0 2 4 1 3:  %d NACKs (2 expected), %d delivered (5 expected)\n",
+         nacks_sent, messages_delivered);
+  failed = nacks_sent != 2 || messages_delivered != 5;
+  printf("%s\n", failed ? "FAILED" : "passed");
+  return failed;
+}
+
+/* one replication: simulate with the given seed, measure after warm-up */
+static void runreplica(unsigned int seed, struct repsample *out)
+{
+  int measured;
+  double span;
+
+  reset(seed);
+  initflows();
+  simulate();
+
+  measured = messages_delivered - warmup;
+  span = lastdelivery - warmup_time;
+  out->goodput = (measured > 0 && span > 0.0) ? measured / span : 0.0;
+  out->retx_per_msg = measured > 0 ? (double)(packets_resent - warmup_resent) / measured : 0.0;
+  out->latency = measured > 0 ? latencysum / measured : 0.0;
+  out->measured = measured;
+}
+
+/********************** THE LIBRARY INTERFACE ***********************/
+/* The entry points of sim.h.  main.c, the command-line front end,   */
+/* drives the emulator through them like any other program.          */
+/*********************************************************************/
+
+struct sim {
+  int configured;           /* the options are complete */
+  int started;              /* the run has begun, on this thread */
+  int replicated;           /* sim_run() ran replications */
+  unsigned int seed;
+};
+
+static struct sim thesim;   /* the one simulation of the process */
+static int simlive = 0;
+
+struct sim *sim_create(void)
+{
+  static int once = 0;
+
+  if (simlive)
+    return NULL;
+  if (!once) {
+    checksum_init();
+    once = 1;
+  }
+  memset(&thesim, 0, sizeof(thesim));
+  thesim.seed = 9999;
+  simlive = 1;
+  return &thesim;
+}
+
+/* the handle all the calls take: the simulation sim_create() made and
+   sim_destroy() has not ended */
+static void live(const struct sim *s)
+{
+  if (s != &thesim || !simlive) {
+    printf("not a live simulation\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int sim_option(struct sim *s, const char *arg)
+{
+  live(s);
+  if (s->configured) {
+    printf("options must come before the parameters: %s\n", arg);
+    exit(EXIT_FAILURE);
+  }
+  return option(arg);
+}
+
+/* the options are complete: set up the flows and check the combination */
+static void configure(struct sim *s)
+{
+  if (s->configured)
+    return;
+  allocflows();
+  if (parallel_threads > 0 &&
+      (instrument || warmup > 0 || replicate_max > 0 || checkpoint_time >= 0.0 || checkpoint_msgs >= 0)) {
+    printf("--threads can not be combined with --instrument, --warmup, --replicate or a checkpoint\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((checkpoint_time >= 0.0 || checkpoint_msgs >= 0) && checkpoint_branches() == 0) {
+    printf("a checkpoint (--checkpoint-time or --checkpoint-msgs) needs at least one --branch\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((path_hops > 0 || parallel_threads > 0) &&
+      (reorderprob[A] > 0.0 || reorderprob[B] > 0.0 || dupprob[A] > 0.0 || dupprob[B] > 0.0)) {
+    printf("--reorder and --duplicate apply to the single-hop medium, not with --hop or --threads\n");
+    exit(EXIT_FAILURE);
+  }
+  /* several flows run in windows whether or not there are threads, so
+     --threads=N gives the results of a run without it; what needs the
+     one event list of all flows keeps it */
+  lpmode = nflows > 1 && !instrument && warmup == 0 && replicate_max == 0 &&
+           checkpoint_time < 0.0 && checkpoint_msgs < 0 &&
+           reorderprob[A] == 0.0 && reorderprob[B] == 0.0 && dupprob[A] == 0.0 && dupprob[B] == 0.0;
+  s->configured = 1;
+}
+
+void sim_params(struct sim *s, const struct sim_params *p)
+{
+  live(s);
+  configure(s);
+  nsimmax = p->nsimmax;
+  lossprob = p->lossprob;
+  corruptprob = p->corruptprob;
+  corruptdirection = p->corruptdirection;
+  lambda = p->lambda;
+  TRACE = p->trace;
+  if (s->started) {         /* the run goes on with them, as a branch would */
+    if (p->seed != s->seed)
+      srand(p->seed);
+    resetsampling();
+  }
+  s->seed = p->seed;
+}
+
+void sim_readparams(struct sim *s)
+{
+  live(s);
+  configure(s);
+  readparams();
+}
+
+void sim_on_delivery(struct sim *s, sim_delivery_fn *fn, void *arg)
+{
+  live(s);
+  ondelivery = fn;
+  ondeliveryarg = arg;
+}
+
+void sim_on_event(struct sim *s, sim_event_fn *fn, void *arg)
+{
+  live(s);
+  onevent = fn;
+  oneventarg = arg;
+}
+
+static void needparams(const struct sim *s)
+{
+  if (!s->configured) {
+    printf("the parameters must be given before the run\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* begin a run to be stepped through on this thread */
+static void start(struct sim *s)
+{
+  needparams(s);
+  if (parallel_threads > 0 || replicate_max > 0) {
+    printf("a run with --threads or --replicate can not be stepped through\n");
+    exit(EXIT_FAILURE);
+  }
+  lpmode = 0;                    /* a step is one event of the one list */
+  reset(s->seed);
+  initflows();
+  s->started = 1;
+}
+
+int sim_step(struct sim *s)
+{
+  live(s);
+  if (!s->started)
+    start(s);
+  return step();
+}
+
+long sim_run_until(struct sim *s, double until, long maxevents)
+{
+  long n = 0;
+
+  live(s);
+  if (!s->started)
+    start(s);
+  while ((maxevents <= 0 || n < maxevents) && evlist.len > 0 &&
+         (until < 0.0 || evlist.ev[0]->evtime < until) && step())
+    n++;
+  return n;
+}
+
+void sim_run(struct sim *s)
+{
+  live(s);
+  needparams(s);
+  if (lpmode && !s->started) {
+    if (parallel_threads > 0)
+      TRACE = 0;                 /* the threads run silently */
+    reset(s->seed);
+    initflows();
+    runlps();
+  }
+  else if (replicate_max > 0) {
+    TRACE = 0;                   /* replications run silently */
+    replicate(runreplica);
+    s->replicated = 1;
+  }
+  else {
+    if (!s->started)
+      start(s);
+    simulate();
+  }
+}
+
+void sim_stats(const struct sim *s, struct sim_stats *st)
+{
+  live(s);
+  st->time = time;
+  st->nsim = nsim;
+  st->window_full = window_full;
+  st->new_ACKs = new_ACKs;
+  st->packets_resent = packets_resent;
+  st->packets_received = packets_received;
+  st->messages_delivered = messages_delivered;
+  st->bytes_delivered = bytes_delivered;
+  st->packets_timeout = packets_timeout;
+  st->packets_sent = packets_sent;
+  st->packets_lost = packets_lost;
+  st->packets_corrupt = packets_corrupt;
+  st->packets_reordered = packets_reordered;
+  st->packets_duplicated = packets_duplicated;
+  st->goodput = lastdelivery > 0.0 ? bytes_delivered / lastdelivery : 0.0;
+  st->latency = messages_delivered > warmup ? latencysum / (messages_delivered - warmup) : 0.0;
+  st->stopped = stop_reason;
+}
+
+void sim_flowstats(const struct sim *s, int flow, struct sim_flowstats *st)
+{
+  const struct flow *f;
+
+  live(s);
+  if (flows == NULL || flow < 0 || flow >= nflows) {
+    printf("no flow %d\n", flow);
+    exit(EXIT_FAILURE);
+  }
+  f = &flows[flow];
+  st->nsim = f->nsim;
+  st->delivered = f->delivered;
+  st->bytes = f->bytes;
+  st->latency = f->delivered > 0 ? f->latencysum / f->delivered : 0.0;
+  st->resent = f->resent;
+  st->dropped = f->dropped;
+}
+
+int sim_branch(const struct sim *s)
+{
+  live(s);
+  return checkpoint_branch();
+}
+
+void sim_report(const struct sim *s)
+{
+  live(s);
+  if (!s->replicated)        /* replications have printed their summary */
+    report();
+}
+
+void sim_destroy(struct sim *s)
+{
+  int i;
+
+  live(s);
+  ondelivery = NULL;
+  onevent = NULL;
+  freeflows();
+  if (outboxes != NULL) {
+    for (i = 0; i < noutboxes; i++)
+      free(outboxes[i].rec);
+    free(outboxes);
+    outboxes = NULL;
+  }
+  resetoptions();
+  memset(s, 0, sizeof(*s));
+  simlive = 0;
+}
@@ -1,11 +1,16 @@
 extern int TRACE;
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* statistics updated by GBN, kept per thread (see --threads) */
+extern __thread int total_ACKs_received;
+extern __thread int packets_resent;       /* count of the number of packets resent  */
+extern __thread int new_ACKs;      /* count of the number of acks correctly received */
+extern __thread int packets_received;  /* count of the packets received by receiver */
+extern __thread int window_full; /* count of the number of messages dropped due to full window */
+extern __thread int nacks_sent;  /* count of the negative acknowledgements sent by B */
+extern __thread int packets_resent_nack;  /* resends triggered by a NACK rather than a timeout */
+
+/* protocol options set on the command line */
+extern int nack;        /* B asks for missing packets with NACKs (sr.c) */
 
 #define   A    0
 #define   B    1
@@ -13,28 +18,69 @@ extern int window_full; /* count of the number of messages dropped due to full w
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
+/* Larger messages keep their bytes in a shared buffer (see payload.h); */
+/* data then holds just their first 20 bytes.                           */
+struct pbuf;
+
 struct msg {
   char data[20];
+  int length;           /* message size in bytes (20 for a classic message) */
+  struct pbuf *buf;     /* all of the message's bytes, NULL if classic */
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
 /* 3 (teachers code).  Note the pre-defined packet structure, which all   */
 /* students must follow. */
+/* Segments of a larger message leave payload unused and instead refer */
+/* to length bytes at offset in the message's shared buffer.            */
 struct pkt {
   int seqnum;
   int acknum;
   int checksum;
   char payload[20];
+  int length;           /* bytes carried in buf, 0 for a classic payload */
+  int offset;           /* position of those bytes in the message */
+  int msglen;           /* size of the whole message */
+  struct pbuf *buf;     /* the message's bytes, NULL for a classic payload */
 };
 
-/* send to A or B (int), packet to send */
+/* send to A or B (int), packet to send.  This is the original interface: */
+/* the packet always goes out with a classic 20 byte payload.            */
 extern void tolayer3(int, struct pkt);  
 
+/* send to A or B (int), pointer to packet to send.  Same as tolayer3()
+   without copying the packet on the way in; every field must be set */
+extern void tolayer3_ref(int, const struct pkt *);
+
+/* send to A or B (int), packets to send, number of packets.  Same as
+   calling tolayer3() for each packet in turn, but cheaper */
+extern void tolayer3_batch(int, const struct pkt[], int);
+
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(int, const char[20]); 
+
+/* deliver to A or B (int), buffer holding the message, message size */
+extern void tolayer5_buf(int, const struct pbuf *, int);
+
+/* current simulated time */
+extern double get_sim_time(void);
+
+/* receive buffer statistics, for a receiver that holds out-of-order packets: */
+/* number of packets it now holds */
+extern void rcvbuf_occupancy(int);
+/* a held packet, which arrived at the given time, is delivered in order */
+extern void rcvbuf_release(double);
+/* a packet the receiver found missing at the given time has arrived */
+extern void loss_recovered(double);
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* call pace_release() for A or B (int) after increment, with the given
+   pacer; the sender's pacer (pace.h) uses it, independently of the
+   timer above */
+struct pacer;
+extern void startpacetimer(int, double, struct pacer *);               
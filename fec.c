@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "fec.h"
+#include "payload.h"
+#include "checksum.h"
+#include "pace.h"
+
+#define NOTINUSE (-1)
+
+/* a parity buffer starts with the XOR of these, then the segment bytes */
+#define FEC_HDR (4 * sizeof(int) + 20)
+
+int fec_k = 0;
+
+__thread int fec_data_sent;
+__thread int fec_parity_sent;
+__thread int fec_recovered;
+
+/* XOR a packet's seqnum, segment fields, payload and bytes into acc */
+static void accumulate(unsigned char *acc, const struct pkt *p)
+{
+  int fields[4];
+  const unsigned char *b;
+  int i;
+
+  fields[0] = p->seqnum;
+  fields[1] = p->length;
+  fields[2] = p->offset;
+  fields[3] = p->msglen;
+  b = (const unsigned char *)fields;
+  for (i = 0; i < (int)sizeof(fields); i++)
+    acc[i] ^= b[i];
+  for (i = 0; i < 20; i++)
+    acc[sizeof(fields) + i] ^= (unsigned char)p->payload[i];
+  if (p->buf != NULL) {
+    b = (const unsigned char *)p->buf->data + p->offset;
+    for (i = 0; i < p->length; i++)
+      acc[FEC_HDR + i] ^= b[i];
+  }
+}
+
+void fec_sender_init(struct fecsender *f, struct pacer *pacer)
+{
+  free(f->acc);
+  f->acc = calloc(1, FEC_HDR + payload_mss);
+  if (f->acc == NULL) {
+    printf("memory allocation for parity failed.");
+    exit(EXIT_FAILURE);
+  }
+  f->pacer = pacer;
+  f->next = 0;
+  f->count = 0;
+  f->maxlen = 0;
+  fec_data_sent = 0;
+  fec_parity_sent = 0;
+}
+
+void fec_number(struct fecsender *f, struct pkt *p)
+{
+  p->acknum = f->next++;
+}
+
+void fec_sent(struct fecsender *f, const struct pkt *p)
+{
+  struct pkt parity;
+  int size;
+
+  fec_data_sent++;
+  accumulate(f->acc, p);
+  if (p->length > f->maxlen)
+    f->maxlen = p->length;
+  if (++f->count < fec_k)
+    return;
+
+  /* the group is complete: send its parity */
+  size = FEC_HDR + f->maxlen;
+  parity.seqnum = FEC_PARITY;
+  parity.acknum = p->acknum / fec_k;
+  memset(parity.payload, 0, sizeof(parity.payload));
+  parity.buf = pbuf_alloc(size);
+  memcpy(parity.buf->data, f->acc, size);
+  parity.length = parity.msglen = size;
+  parity.offset = 0;
+  parity.checksum = pkt_checksum(&parity);
+  if (TRACE > 0)
+    printf("Sending parity packet for group %d to layer 3\n", parity.acknum);
+  pace_send(f->pacer, A, &parity, 1);
+  pkt_release(&parity);
+  fec_parity_sent++;
+
+  memset(f->acc, 0, FEC_HDR + f->maxlen);
+  f->count = 0;
+  f->maxlen = 0;
+}
+
+void fec_receiver_init(struct fecreceiver *f)
+{
+  int i;
+
+  for (i = 0; i < FEC_RING; i++) {
+    pkt_release(&f->data[i]);
+    pkt_release(&f->parity[i]);
+    f->data[i].acknum = NOTINUSE;
+    f->parity[i].acknum = NOTINUSE;
+    f->done[i] = 0;
+  }
+  fec_recovered = 0;
+}
+
+/* keep a copy of p, with its own buffer reference, in slot */
+static void keep(struct pkt *slot, const struct pkt *p)
+{
+  pkt_release(slot);
+  *slot = *p;
+  if (slot->buf != NULL)
+    pbuf_ref(slot->buf);
+}
+
+/* rebuild the one missing packet of group g, if that is possible now */
+static int rebuild(struct fecreceiver *f, int g, struct pkt *rebuilt)
+{
+  const struct pkt *parity = &f->parity[g % FEC_RING];
+  unsigned char *acc;
+  int fields[4];
+  int missing = NOTINUSE;
+  int i, j;
+
+  if (parity->acknum != g || f->done[g % FEC_RING])
+    return 0;
+  for (j = 0; j < fec_k; j++) {
+    i = g * fec_k + j;
+    if (f->data[i % FEC_RING].acknum != i) {
+      if (missing != NOTINUSE)
+        return 0;                /* two or more lost: parity cannot help */
+      missing = i;
+    }
+  }
+  f->done[g % FEC_RING] = 1;
+  if (missing == NOTINUSE)
+    return 0;                    /* nothing was lost */
+
+  acc = malloc(parity->length);
+  if (acc == NULL) {
+    printf("memory allocation for parity failed.");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(acc, parity->buf->data, parity->length);
+  for (j = 0; j < fec_k; j++) {
+    i = g * fec_k + j;
+    if (i != missing)
+      accumulate(acc, &f->data[i % FEC_RING]);
+  }
+
+  memcpy(fields, acc, sizeof(fields));
+  rebuilt->seqnum = fields[0];
+  rebuilt->acknum = missing;
+  rebuilt->length = fields[1];
+  rebuilt->offset = fields[2];
+  rebuilt->msglen = fields[3];
+  memcpy(rebuilt->payload, acc + sizeof(fields), 20);
+  rebuilt->buf = NULL;
+  if (rebuilt->length > 0) {
+    if (rebuilt->length > parity->length - (int)FEC_HDR || rebuilt->offset < 0
+        || rebuilt->offset + rebuilt->length > rebuilt->msglen) {
+      free(acc);
+      return 0;
+    }
+    rebuilt->buf = pbuf_alloc(rebuilt->msglen);
+    memset(rebuilt->buf->data, 0, rebuilt->msglen);
+    memcpy(rebuilt->buf->data + rebuilt->offset, acc + FEC_HDR, rebuilt->length);
+  }
+  free(acc);
+  rebuilt->checksum = pkt_checksum(rebuilt);
+
+  keep(&f->data[missing % FEC_RING], rebuilt);
+  fec_recovered++;
+  if (TRACE > 0)
+    printf("----B: packet %d rebuilt from the parity of group %d\n", rebuilt->seqnum, g);
+  return 1;
+}
+
+int fec_input(struct fecreceiver *f, const struct pkt *p, struct pkt *rebuilt)
+{
+  struct pkt *slot;
+
+  if (p->seqnum == FEC_PARITY) {
+    slot = &f->parity[p->acknum % FEC_RING];
+    if (slot->acknum == p->acknum)
+      return 0;                  /* already have it */
+    keep(slot, p);
+    f->done[p->acknum % FEC_RING] = 0;
+    return rebuild(f, p->acknum, rebuilt);
+  }
+  if (p->acknum < 0)
+    return 0;
+  slot = &f->data[p->acknum % FEC_RING];
+  if (slot->acknum == p->acknum)
+    return 0;
+  keep(slot, p);
+  return rebuild(f, p->acknum / fec_k, rebuilt);
+}
+
+const struct pkt *fec_held(const struct fecreceiver *f, int index)
+{
+  const struct pkt *slot = &f->data[index % FEC_RING];
+
+  return slot->acknum == index ? slot : NULL;
+}
+
+void fec_report(void)
+{
+  if (fec_k == 0)
+    return;
+  printf("number of parity packets sent by A:  %d (%.1f%% overhead over %d data packets) \n",
+         fec_parity_sent, fec_data_sent > 0 ? 100.0 * fec_parity_sent / fec_data_sent : 0.0,
+         fec_data_sent);
+  printf("number of lost packets rebuilt by FEC at B:  %d \n", fec_recovered);
+}
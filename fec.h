@@ -0,0 +1,66 @@
+/* ******************************************************************
+   Forward error correction with XOR parity, shared by gbn.c and sr.c.
+
+   With fec_k > 0 the sender numbers every new data packet with its own
+   running index, carried in acknum (which data packets do not use
+   otherwise).  After each group of fec_k new packets it sends a parity
+   packet, seqnum FEC_PARITY and acknum the group number, whose buffer
+   holds the XOR of the group's seqnum, segment fields, payload and
+   segment bytes.  Retransmissions keep their index and are not added
+   to any group.
+
+   The receiver keeps the packets it has seen, and once a group's
+   parity and all but one of its packets are in, it rebuilds the
+   missing one, which the protocol then takes as if it had arrived.
+   A rebuilt segment gets a buffer of its own holding just its bytes.
+   emulator.h must be included first.
+**********************************************************************/
+
+#define FEC_PARITY (-3)   /* seqnum of a parity packet; acknum is its group */
+#define FEC_MAXK   64     /* largest group */
+#define FEC_RING   256    /* packets and groups a receiver remembers */
+
+extern int fec_k;         /* data packets per parity packet, 0 for no FEC */
+
+/* statistics */
+extern __thread int fec_data_sent;     /* new data packets sent while FEC was on */
+extern __thread int fec_parity_sent;   /* parity packets sent */
+extern __thread int fec_recovered;     /* lost packets rebuilt from parity */
+
+struct pacer;
+
+struct fecsender {
+  int next;                /* index of the next new data packet */
+  int count;               /* packets in the group so far */
+  int maxlen;              /* longest segment in the group */
+  unsigned char *acc;      /* XOR of the group so far */
+  struct pacer *pacer;     /* the sender's pacer, parity is paced too */
+};
+
+struct fecreceiver {
+  struct pkt data[FEC_RING];     /* by index, acknum NOTINUSE if empty */
+  struct pkt parity[FEC_RING];   /* by group, acknum NOTINUSE if empty */
+  char done[FEC_RING];           /* group needs nothing more */
+};
+
+extern void fec_sender_init(struct fecsender *f, struct pacer *pacer);
+
+/* give a new data packet its index, before its checksum is computed */
+extern void fec_number(struct fecsender *f, struct pkt *p);
+
+/* account for a new data packet A just sent to layer 3, and send the
+   parity packet once the group is complete */
+extern void fec_sent(struct fecsender *f, const struct pkt *p);
+
+extern void fec_receiver_init(struct fecreceiver *f);
+
+/* note an uncorrupted packet from A, data or parity.  Returns 1 if it
+   let a lost packet be rebuilt into *rebuilt, which holds a buffer
+   reference the caller drops with pkt_release() */
+extern int fec_input(struct fecreceiver *f, const struct pkt *p, struct pkt *rebuilt);
+
+/* the data packet with the given index, if the receiver has seen it */
+extern const struct pkt *fec_held(const struct fecreceiver *f, int index);
+
+/* parity overhead and recoveries, when FEC is on */
+extern void fec_report(void);
@@ -1,8 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "gbn.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -32,23 +38,16 @@
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
+   The engine (additive sum or CRC-32C) is chosen with --checksum.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
+  return pkt_checksum(packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
@@ -57,46 +56,94 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+struct sender {
+  struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+  struct pbuf *segbuf;            /* message still being cut into segments, or NULL */
+  int segoffset, seglen;          /* next offset to send and size of that message */
+  struct fecsender A_fec;         /* parity of the packets sent so far, with --fec */
+  struct pacer A_pace;            /* token bucket, with --pace */
+};
+
+/* A's state, one per flow (see protocol_flows()); snd is the flow the
+   emulator is calling for on this thread */
+static struct sender sender0;
+static struct sender *senders = &sender0;
+static __thread struct sender *snd = &sender0;
+
+/* number, checksum, buffer and send a packet whose payload is filled in */
+static void A_send(struct pkt *sendpkt)
+{
+  sendpkt->seqnum = snd->A_nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  if (fec_k > 0)
+    fec_number(&snd->A_fec, sendpkt);
+  sendpkt->checksum = ComputeChecksum(sendpkt);
+
+  /* put packet in window buffer */
+  /* windowlast will always be 0 for alternating bit; but not for GoBackN */
+  snd->windowlast = (snd->windowlast + 1) % WINDOWSIZE;
+  snd->buffer[snd->windowlast] = *sendpkt;
+  snd->windowcount++;
+
+  /* send out packet */
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  pace_send(&snd->A_pace, A, sendpkt, 1);
+  if (fec_k > 0)
+    fec_sent(&snd->A_fec, sendpkt);
+
+  /* start timer if first packet in window */
+  if (snd->windowcount == 1)
+    starttimer(A,RTT);
+
+  /* get next sequence number, wrap back to 0 */
+  snd->A_nextseqnum = (snd->A_nextseqnum + 1) % SEQSPACE;
+}
+
+/* send as many segments of the current large message as the window allows */
+static void A_sendsegments(void)
+{
+  struct pkt sendpkt;
+
+  while (snd->segbuf != NULL && snd->windowcount < WINDOWSIZE) {
+    snd->segoffset += pkt_segment(&sendpkt, snd->segbuf, snd->segoffset, snd->seglen);
+    A_send(&sendpkt);
+    if (snd->segoffset == snd->seglen) {
+      pbuf_unref(snd->segbuf);
+      snd->segbuf = NULL;
+    }
+  }
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output_ref(const struct msg *message)
 {
   struct pkt sendpkt;
   int i;
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  /* if not blocked waiting on ACK (or on the rest of a large message) */
+  if ( snd->windowcount < WINDOWSIZE && snd->segbuf == NULL) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
+    if (message->buf != NULL) {
+      /* large message: segments refer to its buffer, they do not copy it */
+      snd->segbuf = pbuf_ref(message->buf);
+      snd->segoffset = 0;
+      snd->seglen = message->length;
+      A_sendsegments();
+      return;
+    }
+
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+      sendpkt.payload[i] = message->data[i];
+    sendpkt.length = sendpkt.offset = sendpkt.msglen = 0;
+    sendpkt.buf = NULL;
+    A_send(&sendpkt);
   }
   /* if blocked,  window is full */
   else {
@@ -110,7 +157,7 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input_ref(const struct pkt *packet)
 {
   int ackcount = 0;
   int i;
@@ -118,40 +165,45 @@ void A_input(struct pkt packet)
   /* if received ACK is not corrupted */
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+    if (snd->windowcount != 0) {
+          int seqfirst = snd->buffer[snd->windowfirst].seqnum;
+          int seqlast = snd->buffer[snd->windowlast].seqnum;
           /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+          if (((seqfirst <= seqlast) && (packet->acknum >= seqfirst && packet->acknum <= seqlast)) ||
+              ((seqfirst > seqlast) && (packet->acknum >= seqfirst || packet->acknum <= seqlast))) {
 
             /* packet is a new ACK */
             if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+              printf("----A: ACK %d is not a duplicate\n",packet->acknum);
             new_ACKs++;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
+            if (packet->acknum >= seqfirst)
+              ackcount = packet->acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+              ackcount = SEQSPACE - seqfirst + packet->acknum;
 
             /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
-              windowcount--;
+            for (i=0; i<ackcount; i++) {
+              pkt_release(&snd->buffer[(snd->windowfirst + i) % WINDOWSIZE]);
+              snd->windowcount--;
+            }
+
+	    /* slide window by the number of packets ACKed */
+            snd->windowfirst = (snd->windowfirst + ackcount) % WINDOWSIZE;
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
-            if (windowcount > 0)
+            if (snd->windowcount > 0)
               starttimer(A, RTT);
 
+            /* the window has room again for the rest of a large message */
+            A_sendsegments();
+
           }
         }
         else
@@ -164,21 +216,26 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void)
 {
+  struct pkt resend[WINDOWSIZE];
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  /* resend the whole window with a single call to layer 3 */
+  for(i=0; i<snd->windowcount; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", (snd->buffer[(snd->windowfirst+i) % WINDOWSIZE]).seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    resend[i] = snd->buffer[(snd->windowfirst+i) % WINDOWSIZE];
     packets_resent++;
-    if (i==0) starttimer(A,RTT);
+  }
+  if (snd->windowcount > 0) {
+    pace_send(&snd->A_pace, A, resend, snd->windowcount);
+    starttimer(A,RTT);
   }
 }
 
@@ -186,78 +243,194 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void)
 {
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
+  snd->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  snd->windowfirst = 0;
+  snd->windowlast = -1;   /* windowlast is where the last packet sent is stored.
 		     new packets are placed in winlast + 1
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  snd->windowcount = 0;
+  snd->segbuf = NULL;
+  if (fec_k > 0)
+    fec_sender_init(&snd->A_fec, &snd->A_pace);
+  pace_init(&snd->A_pace, WINDOWSIZE / RTT);
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+  struct reassembly B_reasm;   /* segments of the message being received */
+  struct fecreceiver *B_fec;   /* packets kept to rebuild losses, with --fec */
+};
 
+static struct receiver receiver0;
+static struct receiver *receivers = &receiver0;
+static __thread struct receiver *rcv = &receiver0;
+static int ncopies = 1;       /* flows in senders and receivers */
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+/* take a packet if it is the one expected next, returns 0 if it is not */
+static int B_accept(const struct pkt *packet)
 {
-  struct pkt sendpkt;
-  int i;
+  if (packet->seqnum != rcv->expectedseqnum)
+    return 0;
+  if (TRACE > 0)
+    printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
+  packets_received++;
 
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+  /* deliver to receiving application (once complete, for a large message) */
+  deliver_segment(&rcv->B_reasm, B, packet);
+
+  /* update state variables */
+  rcv->expectedseqnum = (rcv->expectedseqnum + 1) % SEQSPACE;
+  return 1;
+}
 
-    /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+/* take a packet FEC rebuilt, then the packets after it that arrived while
+   it was missing and had to be discarded */
+static void B_rebuilt(const struct pkt *packet)
+{
+  const struct pkt *next;
+  int index = packet->acknum;
+
+  if (!B_accept(packet))
+    return;
+  while ((next = fec_held(rcv->B_fec, ++index)) != NULL && B_accept(next))
+    ;
+}
 
-    /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+static void B_input_ref(const struct pkt *packet)
+{
+  struct pkt sendpkt, rebuilt;
+  int i;
 
-    /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+  /* if not corrupted and received packet is in order */
+  if  ( (!IsCorrupted(packet))  && (packet->seqnum == FEC_PARITY || B_accept(packet)) ) {
+    if (packet->seqnum == FEC_PARITY && TRACE > 0)
+      printf("----B: parity packet for group %d is received\n", packet->acknum);
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0)
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
   }
 
+  /* a lost packet FEC can rebuild counts as received */
+  if (fec_k > 0 && !IsCorrupted(packet) && fec_input(rcv->B_fec, packet, &rebuilt)) {
+    B_rebuilt(&rebuilt);
+    pkt_release(&rebuilt);
+  }
+
+  /* ACK the last packet received in order */
+  if (rcv->expectedseqnum == 0)
+    sendpkt.acknum = SEQSPACE - 1;
+  else
+    sendpkt.acknum = rcv->expectedseqnum - 1;
+
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt.seqnum = rcv->B_nextseqnum;
+  rcv->B_nextseqnum = (rcv->B_nextseqnum + 1) % 2;
 
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ )
     sendpkt.payload[i] = '0';
 
+  sendpkt.length = sendpkt.offset = sendpkt.msglen = 0;
+  sendpkt.buf = NULL;
+
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt);
+  sendpkt.checksum = ComputeChecksum(&sendpkt);
 
   /* send out packet */
-  tolayer3 (B, sendpkt);
+  tolayer3_ref (B, &sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  rcv->expectedseqnum = 0;
+  rcv->B_nextseqnum = 1;
+  rcv->B_reasm.next = 0;
+  rcv->B_reasm.buf = NULL;
+  if (fec_k > 0) {
+    if (rcv->B_fec == NULL)
+      rcv->B_fec = calloc(1, sizeof(struct fecreceiver));
+    if (rcv->B_fec == NULL) {
+      printf("memory allocation for FEC failed.");
+      exit(EXIT_FAILURE);
+    }
+    fec_receiver_init(rcv->B_fec);
+  }
+}
+
+/* the callbacks that follow act for the given flow */
+static void protocol_bind(int flow)
+{
+  snd = &senders[flow];
+  rcv = &receivers[flow];
+}
+
+/* drop the buffers and FEC state the copies of an earlier simulation
+   still hold */
+static void dropflows(void)
+{
+  struct sender *s;
+  struct receiver *r;
+  int i, k;
+
+  for (i = 0; i < ncopies; i++) {
+    s = &senders[i];
+    r = &receivers[i];
+    for (k = 0; k < WINDOWSIZE; k++)
+      pkt_release(&s->buffer[k]);
+    if (s->segbuf != NULL)
+      pbuf_unref(s->segbuf);
+    free(s->A_fec.acc);
+    if (r->B_reasm.buf != NULL)
+      pbuf_unref(r->B_reasm.buf);
+    if (r->B_fec != NULL) {
+      for (k = 0; k < FEC_RING; k++) {
+        pkt_release(&r->B_fec->data[k]);
+        pkt_release(&r->B_fec->parity[k]);
+      }
+      free(r->B_fec);
+    }
+    memset(s, 0, sizeof(*s));
+    memset(r, 0, sizeof(*r));
+  }
+}
+
+/* n copies of A's and B's state, for a run with n flows */
+static void protocol_flows(int n)
+{
+  dropflows();
+  if (senders != &sender0) {    /* an earlier simulation's */
+    free(senders);
+    free(receivers);
+  }
+  senders = &sender0;
+  receivers = &receiver0;
+  ncopies = 1;
+  if (n <= 1) {
+    protocol_bind(0);
+    return;
+  }
+  senders = calloc(n, sizeof(struct sender));
+  receivers = calloc(n, sizeof(struct receiver));
+  if (senders == NULL || receivers == NULL) {
+    printf("memory allocation for %d flows failed.", n);
+    exit(EXIT_FAILURE);
+  }
+  ncopies = n;
+  protocol_bind(0);
 }
 
 /******************************************************************************
@@ -265,11 +438,18 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void)
 {
 }
+
+/* what the emulator and the transports run, see protocol.h */
+const struct protocol gbn_protocol = {
+  "gbn", A_init, B_init, A_output_ref, A_input_ref, B_input_ref,
+  A_timerinterrupt, B_timerinterrupt, B_output, protocol_flows, protocol_bind,
+  PROTO_SEGMENTS | PROTO_FEC | PROTO_PACE
+};
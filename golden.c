@@ -0,0 +1,481 @@
+/* ******************************************************************
+   Golden regression harness, a second front end of the emulator
+   library (sim.h).
+
+   Runs every linked-in protocol over a fixed set of parameter points
+   and seeds, and digests each run: every event the emulator handles
+   and every delivery to layer 5 (time, type, entity, flow, bytes) go
+   into one 64-bit FNV-1a hash, the final statistics into another.  The
+   digests are compared with those recorded in golden.txt, so a change
+   meant to be a pure speedup (event list, allocator, RNG, checksums)
+   shows up as soon as it changes any run by a single event or bit.
+   Several flows run in windows, on --threads threads or on one, and
+   in a window their events interleave differently from one thread
+   count to another, so each flow gets digests of its own, taken
+   together at the end.  A run with threads must come out exactly as
+   its twin without them.
+
+   The runs draw on the C library's rand() and libm, so the digests
+   only hold on the platform that recorded them.  golden.txt names it,
+   and a check on another platform is refused: rebaseline into a file
+   of its own there (--golden=FILE).
+
+     ./golden                 check, exit non-zero on any difference
+     ./golden --rebaseline    record the current digests instead
+     --golden=FILE            another file than golden.txt
+
+   Each run gets a process of its own, so that one that crashes does
+   not take the others with it.  A few sequels run a second protocol
+   after a first in one process: the second must come out exactly as
+   it does on its own, whatever options, flows and protocol state the
+   first left behind.
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "sim.h"
+
+#define MAXOPTS 4
+#define MAXFLOWS 8
+#define MAXLINE 256
+#define MAXRUNS 256
+#define FLOWS 0x100             /* besides the PROTO_ flags: a copy of the
+                                   protocol's state per flow */
+
+/* the parameter points each protocol is run at */
+static const struct point {
+  const char *name;
+  const char *options[MAXOPTS];   /* besides --protocol, NULL ended */
+  int needs;                      /* PROTO_ flags and FLOWS, for the protocols
+                                     the options suit */
+  struct sim_params params;       /* the seed is set per run */
+} points[] = {
+  { "clean",   { NULL }, 0, { 300, 0.0, 0.0, 2, 10.0, 0, 0 } },
+  { "lossy",   { NULL }, 0, { 300, 0.2, 0.2, 2, 10.0, 0, 0 } },
+  { "loaded",  { NULL }, 0, { 500, 0.1, 0.1, 0, 2.0, 0, 0 } },
+  { "acks",    { NULL }, 0, { 300, 0.1, 0.3, 1, 10.0, 0, 0 } },
+  { "bytes",   { "--msgsize=10-3000", NULL }, PROTO_SEGMENTS, { 200, 0.1, 0.1, 2, 10.0, 0, 0 } },
+  { "fec",     { "--fec=4", "--msgsize=100-2500", NULL }, PROTO_FEC | PROTO_SEGMENTS,
+               { 200, 0.15, 0.0, 0, 10.0, 0, 0 } },
+  { "reorder", { "--reorder=0.1", "--duplicate=0.05", "--until=20000", NULL }, 0,
+               { 300, 0.05, 0.05, 2, 10.0, 0, 0 } },
+  { "flows",   { "--flows=3", NULL }, FLOWS, { 200, 0.1, 0.1, 2, 10.0, 0, 0 } },
+  { "windows", { "--flows=4", "--hop=1:1:8", NULL }, FLOWS, { 200, 0.1, 0.1, 2, 10.0, 0, 0 } },
+  { "threads", { "--flows=4", "--threads=2", "--hop=1:1:8", NULL }, FLOWS,
+               { 200, 0.1, 0.1, 2, 10.0, 0, 0 } },
+  { "hops",    { "--hop=2:1:16:0.05", "--hop=1:2:8", NULL }, 0, { 300, 0.05, 0.05, 2, 10.0, 0, 0 } },
+  { "nack",    { "--nack", NULL }, PROTO_NACK, { 300, 0.2, 0.1, 2, 10.0, 0, 0 } },
+  { "pace",    { "--pace=2", "--pace-burst=4", NULL }, PROTO_PACE, { 300, 0.1, 0.1, 2, 2.0, 0, 0 } },
+  { "onoff",   { "--traffic=onoff:50:100", NULL }, 0, { 300, 0.1, 0.1, 2, 10.0, 0, 0 } },
+  { "pareto",  { "--traffic=pareto:1.5", NULL }, 0, { 300, 0.1, 0.1, 2, 10.0, 0, 0 } },
+};
+#define NPOINTS (int)(sizeof(points) / sizeof(points[0]))
+
+static const char *protocols[] = { "gbn", "sr", "sr1" };
+#define NPROTOCOLS (int)(sizeof(protocols) / sizeof(protocols[0]))
+
+/* a run made after another one in the same process */
+static const struct sequel {
+  const char *first, *firstpoint;
+  const char *protocol, *point;
+} sequels[] = {
+  { "gbn", "flows",   "sr",  "fec" },    /* 3 flows, then 1 with FEC */
+  { "sr",  "reorder", "gbn", "flows" },
+  { "sr",  "fec",     "sr1", "lossy" },  /* sr1 has no FEC or segments */
+  { "sr",  "threads", "gbn", "hops" },   /* threads, then one flow on one */
+};
+#define NSEQUELS (int)(sizeof(sequels) / sizeof(sequels[0]))
+
+/* points whose runs must give the same results */
+static const struct twin {
+  const char *point, *same;
+} twins[] = {
+  { "threads", "windows" },   /* --threads=2, then without threads */
+};
+#define NTWINS (int)(sizeof(twins) / sizeof(twins[0]))
+
+static const unsigned int seeds[] = { 1, 1234, 9999 };
+#define NSEEDS (int)(sizeof(seeds) / sizeof(seeds[0]))
+
+/************************** digests ******************************/
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+struct digest {
+  unsigned long long hash;
+  long events;
+};
+
+static void mix(unsigned long long *h, const void *p, size_t n)
+{
+  const unsigned char *b = p;
+
+  while (n-- > 0) {
+    *h ^= *b++;
+    *h *= FNV_PRIME;
+  }
+}
+
+static int perflow = 0;         /* a digest per flow (several flows), else one */
+
+static void onevent(void *arg, double time, int type, int entity, int flow)
+{
+  struct digest *d = (struct digest *)arg + (perflow ? flow : 0);
+
+  mix(&d->hash, &time, sizeof(time));
+  mix(&d->hash, &type, sizeof(type));
+  mix(&d->hash, &entity, sizeof(entity));
+  mix(&d->hash, &flow, sizeof(flow));
+  d->events++;
+}
+
+static void ondelivery(void *arg, int flow, double time, int bytes, double latency)
+{
+  struct digest *d = (struct digest *)arg + (perflow ? flow : 0);
+
+  mix(&d->hash, &flow, sizeof(flow));
+  mix(&d->hash, &time, sizeof(time));
+  mix(&d->hash, &bytes, sizeof(bytes));
+  mix(&d->hash, &latency, sizeof(latency));
+}
+
+/* the final statistics, field by field (the struct has padding) */
+static unsigned long long statsdigest(const struct sim *s, int nflows)
+{
+  unsigned long long h = FNV_OFFSET;
+  struct sim_stats st;
+  struct sim_flowstats fs;
+  int i;
+
+  sim_stats(s, &st);
+  mix(&h, &st.time, sizeof(st.time));
+  mix(&h, &st.nsim, sizeof(st.nsim));
+  mix(&h, &st.window_full, sizeof(st.window_full));
+  mix(&h, &st.new_ACKs, sizeof(st.new_ACKs));
+  mix(&h, &st.packets_resent, sizeof(st.packets_resent));
+  mix(&h, &st.packets_received, sizeof(st.packets_received));
+  mix(&h, &st.messages_delivered, sizeof(st.messages_delivered));
+  mix(&h, &st.bytes_delivered, sizeof(st.bytes_delivered));
+  mix(&h, &st.packets_timeout, sizeof(st.packets_timeout));
+  mix(&h, &st.packets_sent, sizeof(st.packets_sent));
+  mix(&h, &st.packets_lost, sizeof(st.packets_lost));
+  mix(&h, &st.packets_corrupt, sizeof(st.packets_corrupt));
+  mix(&h, &st.packets_reordered, sizeof(st.packets_reordered));
+  mix(&h, &st.packets_duplicated, sizeof(st.packets_duplicated));
+  mix(&h, &st.goodput, sizeof(st.goodput));
+  mix(&h, &st.latency, sizeof(st.latency));
+  for (i = 0; i < nflows; i++) {
+    sim_flowstats(s, i, &fs);
+    mix(&h, &fs.nsim, sizeof(fs.nsim));
+    mix(&h, &fs.delivered, sizeof(fs.delivered));
+    mix(&h, &fs.bytes, sizeof(fs.bytes));
+    mix(&h, &fs.latency, sizeof(fs.latency));
+    mix(&h, &fs.resent, sizeof(fs.resent));
+    mix(&h, &fs.dropped, sizeof(fs.dropped));
+  }
+  return h;
+}
+
+/************************** runs ******************************/
+
+/* run protocol at point p with seed in this process, and write its
+   line: the key, a few counters to tell where it went, and the digests */
+static void runone(const char *protocol, const struct point *p, unsigned int seed,
+                   char line[MAXLINE])
+{
+  struct sim *s = sim_create();
+  struct sim_params params = p->params;
+  struct sim_stats st;
+  struct digest d[MAXFLOWS];
+  char arg[64];
+  int i, nflows = 1;
+
+  snprintf(arg, sizeof(arg), "--protocol=%s", protocol);
+  sim_option(s, arg);
+  for (i = 0; i < MAXOPTS && p->options[i] != NULL; i++) {
+    if (!sim_option(s, p->options[i])) {
+      printf("unknown option: %s\n", p->options[i]);
+      exit(EXIT_FAILURE);
+    }
+    if (strncmp(p->options[i], "--flows=", 8) == 0)
+      nflows = atoi(p->options[i] + 8);
+  }
+  perflow = nflows > 1;
+  for (i = 0; i < MAXFLOWS; i++) {
+    d[i].hash = FNV_OFFSET;
+    d[i].events = 0;
+  }
+  params.seed = seed;
+  sim_params(s, &params);
+  sim_on_event(s, onevent, d);
+  sim_on_delivery(s, ondelivery, d);
+  sim_run(s);
+  sim_stats(s, &st);
+  if (perflow) {                  /* the flows' digests, in flow order */
+    for (i = 1; i < nflows; i++) {
+      mix(&d[0].hash, &d[i].hash, sizeof(d[i].hash));
+      d[0].events += d[i].events;
+    }
+  }
+  perflow = 0;
+  snprintf(line, MAXLINE, "%s %s %u: %ld events, %d delivered, %d resent, %016llx %016llx",
+           protocol, p->name, seed, d[0].events, st.messages_delivered, st.packets_resent,
+           d[0].hash, statsdigest(s, nflows));
+  sim_destroy(s);
+}
+
+static const struct point *findpoint(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NPOINTS; i++)
+    if (strcmp(points[i].name, name) == 0)
+      return &points[i];
+  printf("no point %s\n", name);
+  exit(EXIT_FAILURE);
+}
+
+/* runone() in a child, its stdout (warnings from the protocols) sent to
+   /dev/null, after a run of first at point fp if first is not NULL;
+   returns 0 if it failed */
+static int run(const char *first, const struct point *fp, const char *protocol,
+               const struct point *p, unsigned int seed, char line[MAXLINE])
+{
+  int fd[2], status;
+  ssize_t n, got = 0;
+  pid_t pid;
+
+  fflush(stdout);
+  if (pipe(fd) < 0 || (pid = fork()) < 0) {
+    perror("golden");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+      exit(EXIT_FAILURE);
+    if (first != NULL)
+      runone(first, fp, seed, line);
+    runone(protocol, p, seed, line);
+    n = write(fd[1], line, strlen(line) + 1);
+    _exit(n > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fd[1]);
+  while (got < MAXLINE && (n = read(fd[0], line + got, MAXLINE - got)) > 0)
+    got += n;
+  close(fd[0]);
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || got == 0 || line[got - 1] != '\0') {
+    snprintf(line, MAXLINE, "%s %s %u: failed", protocol, p->name, seed);
+    return 0;
+  }
+  return 1;
+}
+
+/************************** golden file ******************************/
+
+static char golden[MAXRUNS][MAXLINE];
+static int ngolden = 0;
+static char goldenplatform[MAXLINE] = "unknown";
+
+#define PLATFORM "# platform: "
+
+/* the C library and architecture the runs depend on */
+static const char *platform(void)
+{
+  static char name[64];
+  const char *libc = "unknown libc", *arch = "unknown";
+
+#if defined(__x86_64__)
+  arch = "x86_64";
+#elif defined(__i386__)
+  arch = "i386";
+#elif defined(__aarch64__)
+  arch = "aarch64";
+#elif defined(__arm__)
+  arch = "arm";
+#endif
+#if defined(__GLIBC__)
+  snprintf(name, sizeof(name), "glibc %d.%d %s", __GLIBC__, __GLIBC_MINOR__, arch);
+  return name;
+#elif defined(__APPLE__)
+  libc = "macOS libc";
+#elif defined(__FreeBSD__)
+  libc = "FreeBSD libc";
+#endif
+  snprintf(name, sizeof(name), "%s %s", libc, arch);
+  return name;
+}
+
+static void readgolden(const char *name)
+{
+  FILE *fp = fopen(name, "r");
+  char *nl;
+
+  if (fp == NULL) {
+    printf("can not read %s, make one with --rebaseline\n", name);
+    exit(EXIT_FAILURE);
+  }
+  while (ngolden < MAXRUNS && fgets(golden[ngolden], MAXLINE, fp) != NULL) {
+    if ((nl = strchr(golden[ngolden], '\n')) != NULL)
+      *nl = '\0';
+    if (strncmp(golden[ngolden], PLATFORM, strlen(PLATFORM)) == 0)
+      snprintf(goldenplatform, MAXLINE, "%s", golden[ngolden] + strlen(PLATFORM));
+    else if (golden[ngolden][0] != '#' && golden[ngolden][0] != '\0')
+      ngolden++;
+  }
+  fclose(fp);
+  if (strcmp(goldenplatform, platform()) != 0) {
+    printf("%s was recorded on %s, this is %s: its digests do not apply here.\n"
+           "Record this platform's with --rebaseline --golden=FILE\n", name, goldenplatform,
+           platform());
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* the line of lines[n] with the same key as line, NULL if there is none */
+static const char *samekey(const char *line, char lines[][MAXLINE], int n)
+{
+  size_t keylen = strchr(line, ':') - line + 1;
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (strncmp(lines[i], line, keylen) == 0)
+      return lines[i];
+  return NULL;
+}
+
+/* the line of lines[n] of protocol at point and seed, NULL if none */
+static const char *findrun(char lines[][MAXLINE], int n, const char *protocol,
+                           const char *point, unsigned int seed)
+{
+  char key[MAXLINE];
+
+  snprintf(key, sizeof(key), "%s %s %u:", protocol, point, seed);
+  return samekey(key, lines, n);
+}
+
+/* compare a run with its recorded line; returns 0 if it changed */
+static int check(const char *line)
+{
+  const char *old = samekey(line, golden, ngolden);
+
+  if (old == NULL)
+    printf("new:     %s\n", line);
+  else if (strcmp(old, line) != 0) {
+    printf("CHANGED: %s\n   was:  %s\n", line, old);
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  static char lines[MAXRUNS][MAXLINE];
+  const struct protocol *proto;
+  const struct sequel *q;
+  const char *file = "golden.txt", *alone, *a, *b;
+  char key[2 * MAXLINE];         /* a sequel's names and its run's line */
+  int rebaseline = 0, nlines = 0, failed = 0, i, j, k;
+  FILE *fp;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rebaseline") == 0)
+      rebaseline = 1;
+    else if (strncmp(argv[i], "--golden=", 9) == 0)
+      file = argv[i] + 9;
+    else {
+      printf("usage: %s [--rebaseline] [--golden=FILE]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!rebaseline)
+    readgolden(file);
+
+  for (i = 0; i < NPROTOCOLS; i++) {
+    if ((proto = protocol_find(protocols[i])) == NULL) {
+      printf("%s: not linked in, skipped\n", protocols[i]);
+      continue;
+    }
+    for (j = 0; j < NPOINTS; j++) {
+      if ((points[j].needs & ~FLOWS & ~proto->caps) ||
+          ((points[j].needs & FLOWS) && proto->flows == NULL))
+        continue;                 /* not for this protocol, like FEC for sr1 */
+      for (k = 0; k < NSEEDS; k++) {
+        if (!run(NULL, NULL, protocols[i], &points[j], seeds[k], lines[nlines])) {
+          printf("FAILED:  %s\n", lines[nlines]);
+          failed++;
+        }
+        else if (!rebaseline && !check(lines[nlines]))
+          failed++;
+        nlines++;
+      }
+    }
+  }
+
+  for (i = 0; i < NTWINS; i++)
+    for (j = 0; j < NPROTOCOLS; j++)
+      for (k = 0; k < NSEEDS; k++) {
+        a = findrun(lines, nlines, protocols[j], twins[i].point, seeds[k]);
+        b = findrun(lines, nlines, protocols[j], twins[i].same, seeds[k]);
+        if (a != NULL && b != NULL && strcmp(strchr(a, ':'), strchr(b, ':')) != 0) {
+          printf("TWINS:   %s\n   differ from: %s\n", a, b);
+          failed++;
+        }
+      }
+
+  for (i = 0; i < NSEQUELS; i++) {
+    q = &sequels[i];
+    if (protocol_find(q->first) == NULL || protocol_find(q->protocol) == NULL)
+      continue;
+    for (k = 0; k < NSEEDS; k++) {
+      if (!run(q->first, findpoint(q->firstpoint), q->protocol, findpoint(q->point),
+               seeds[k], lines[nlines])) {
+        printf("FAILED:  %s %s, then %s\n", q->first, q->firstpoint, lines[nlines]);
+        failed++;
+        continue;
+      }
+      /* the same run in a process of its own, above */
+      alone = samekey(lines[nlines], lines, nlines);
+      if (alone != NULL && strcmp(alone, lines[nlines]) != 0) {
+        printf("LEAKED:  %s %s, then %s\n   alone: %s\n", q->first, q->firstpoint,
+               lines[nlines], alone);
+        failed++;
+      }
+      if (snprintf(key, sizeof(key), "%s %s, then %s", q->first, q->firstpoint,
+                   lines[nlines]) >= MAXLINE) {
+        printf("line too long: %s\n", key);
+        exit(EXIT_FAILURE);
+      }
+      memcpy(lines[nlines], key, strlen(key) + 1);
+      if (!rebaseline && !check(lines[nlines]))
+        failed++;
+      nlines++;
+    }
+  }
+
+  if (rebaseline && failed)
+    printf("%d of %d runs failed, %s left as it was\n", failed, nlines, file);
+  else if (rebaseline) {
+    if ((fp = fopen(file, "w")) == NULL) {
+      perror(file);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "# protocol point seed: events, messages delivered, packets resent,\n");
+    fprintf(fp, "# digest of the event sequence, digest of the final statistics.\n");
+    fprintf(fp, "# Written by ./golden --rebaseline\n");
+    fprintf(fp, PLATFORM "%s\n", platform());
+    for (i = 0; i < nlines; i++)
+      fprintf(fp, "%s\n", lines[i]);
+    fclose(fp);
+    printf("%d runs recorded in %s\n", nlines, file);
+  }
+  else
+    printf("%d runs, %d differ from %s\n", nlines, failed, file);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
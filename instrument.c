@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <time.h>
+#include "instrument.h"
+
+/* ******************************************************************
+   Hot-path instrumentation: per-site call counters and timers, and
+   high-water gauges.  Kept out of emulator.c, which cannot include
+   <time.h> because of its "time" variable.
+**********************************************************************/
+
+int instrument = 0;
+
+struct site {
+  unsigned long long calls;   /* number of times the site was entered */
+  unsigned long long nsec;    /* cumulative time spent inside the site */
+};
+
+struct gauge {
+  long current;   /* last reported value (or running count) */
+  long highwater; /* largest value seen */
+};
+
+static struct site sites[INSTR_NSITES];
+static struct gauge gauges[INSTR_NGAUGES];
+
+static const char *sitenames[INSTR_NSITES] = {
+  "event: timer interrupt",
+  "event: from layer 5",
+  "event: from layer 3",
+  "A_output",
+  "A_input",
+  "B_input",
+  "A_timerinterrupt",
+  "insertevent",
+  "tolayer3"
+};
+
+static const char *gaugenames[INSTR_NGAUGES] = {
+  "event list depth",
+  "event allocations"
+};
+
+/* monotonic clock in nanoseconds */
+unsigned long long instr_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/* close a probe opened at time start */
+void instr_add(int site, unsigned long long start)
+{
+  sites[site].calls++;
+  sites[site].nsec += instr_clock() - start;
+}
+
+/* report the current value of a gauge */
+void instr_gauge(int gauge, long value)
+{
+  gauges[gauge].current = value;
+  if (value > gauges[gauge].highwater)
+    gauges[gauge].highwater = value;
+}
+
+/* bump a counting gauge by one */
+void instr_count(int gauge)
+{
+  instr_gauge(gauge, gauges[gauge].current + 1);
+}
+
+void instr_report(void)
+{
+  int i;
+  double avg;
+
+  if (!instrument)
+    return;
+
+  printf("\n-----  Instrumentation report -------- \n");
+  printf("%-24s %12s %16s %12s\n", "site", "calls", "total ns", "ns/call");
+  for (i = 0; i < INSTR_NSITES; i++) {
+    avg = sites[i].calls ? (double)sites[i].nsec / sites[i].calls : 0.0;
+    printf("%-24s %12llu %16llu %12.1f\n", sitenames[i], sites[i].calls, sites[i].nsec, avg);
+  }
+  printf("%-24s %12s %16s\n", "gauge", "current", "high-water");
+  for (i = 0; i < INSTR_NGAUGES; i++)
+    printf("%-24s %12ld %16ld\n", gaugenames[i], gauges[i].current, gauges[i].highwater);
+}
@@ -0,0 +1,49 @@
+/* ******************************************************************
+   Hot-path instrumentation for the network emulator.
+
+   Records, per event type and per protocol callback, the number of
+   calls and the cumulative time spent (monotonic clock, nanoseconds),
+   together with event list depth and allocation gauges.  Everything
+   is dumped in one report by instr_report().
+
+   Instrumentation is switched on at run time with --instrument.  When
+   it is off each probe costs one well-predicted branch; building with
+   -DNINSTRUMENT removes the probes altogether.
+**********************************************************************/
+
+/* probe sites */
+#define INSTR_EV_TIMER          0   /* TIMER_INTERRUPT events */
+#define INSTR_EV_LAYER5         1   /* FROM_LAYER5 events */
+#define INSTR_EV_LAYER3         2   /* FROM_LAYER3 events */
+#define INSTR_A_OUTPUT          3
+#define INSTR_A_INPUT           4
+#define INSTR_B_INPUT           5
+#define INSTR_A_TIMERINTERRUPT  6
+#define INSTR_INSERTEVENT       7
+#define INSTR_TOLAYER3          8
+#define INSTR_NSITES            9
+
+/* gauges */
+#define INSTR_EVLIST_DEPTH      0   /* events waiting in the event list */
+#define INSTR_EVENT_ALLOCS      1   /* events taken from the event pool */
+#define INSTR_NGAUGES           2
+
+extern int instrument;   /* non-zero when instrumentation is enabled */
+
+extern unsigned long long instr_clock(void);
+extern void instr_add(int site, unsigned long long start);
+extern void instr_gauge(int gauge, long value);
+extern void instr_count(int gauge);
+extern void instr_report(void);
+
+#ifndef NINSTRUMENT
+#define INSTR_START(v)       unsigned long long v = instrument ? instr_clock() : 0
+#define INSTR_STOP(site, v)  do { if (instrument) instr_add((site), (v)); } while (0)
+#define INSTR_GAUGE(g, val)  do { if (instrument) instr_gauge((g), (val)); } while (0)
+#define INSTR_COUNT(g)       do { if (instrument) instr_count(g); } while (0)
+#else
+#define INSTR_START(v)       unsigned long long v = 0
+#define INSTR_STOP(site, v)  ((void)(v))
+#define INSTR_GAUGE(g, val)  ((void)0)
+#define INSTR_COUNT(g)       ((void)0)
+#endif
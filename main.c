@@ -1,29 +1,25 @@
-# include "emulator.h"
-#include "sr.h"
-#include "sr.c"
-#include "emulator.c"
-int main() {
-    init();           // sets up event list, inputs, etc.
+/* ******************************************************************
+   The emulator's command-line front end.  Options come from the
+   command line, the parameters are prompted for on stdin and the
+   report goes to stdout; the emulator itself is a library (sim.h).
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include "sim.h"
 
-    while (1) {
-        struct event *eventptr = evlist;    // get next event
-        if (eventptr == NULL)
-            break;
+int main(int argc, char *argv[])
+{
+  struct sim *s = sim_create();
+  int i;
 
-        evlist = evlist->next;   // remove this event
-
-        time = eventptr->evtime;
-        if (eventptr->evtype == FROM_LAYER5) {
-            // Call A_output or B_output depending on entity
-        } else if (eventptr->evtype == FROM_LAYER3) {
-            // Call A_input or B_input depending on entity
-        } else if (eventptr->evtype == TIMER_INTERRUPT) {
-            // Call A_timerinterrupt or B_timerinterrupt
-        }
-
-        free(eventptr);  // clean up event
+  for (i = 1; i < argc; i++)
+    if (!sim_option(s, argv[i])) {
+      printf("unknown option: %s\n", argv[i]);
+      exit(EXIT_FAILURE);
     }
-
-    // Print stats
-    return 0;
-}
\ No newline at end of file
+  sim_readparams(s);
+  sim_run(s);
+  sim_report(s);
+  sim_destroy(s);
+  return EXIT_SUCCESS;
+}
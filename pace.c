@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "pace.h"
+#include "payload.h"
+
+double pace_rate = 0.0;
+int pace_auto = 0;
+int pace_burst = 1;
+
+__thread int pace_delayed;
+__thread double pace_delay;
+
+struct waiting {
+  struct pkt pkt;           /* holds its own buffer reference */
+  double since;             /* time the packet was handed to the pacer */
+};
+
+/* add the tokens accrued since the last refill */
+static void refill(struct pacer *p)
+{
+  double now = get_sim_time();
+
+  p->tokens += (now - p->last) * pace_rate;
+  if (p->tokens > pace_burst)
+    p->tokens = pace_burst;
+  p->last = now;
+}
+
+/* schedule pace_release() for when the next token is due */
+static void settimer(struct pacer *p, int AorB)
+{
+  if (p->timerset || p->qlen == 0)
+    return;
+  startpacetimer(AorB, (1.0 - p->tokens) / pace_rate, p);
+  p->timerset = 1;
+}
+
+/* queue a packet for a token; a resend of a packet that is still
+   waiting does not queue it twice */
+static void enqueue(struct pacer *p, const struct pkt *packet)
+{
+  struct waiting *bigger;
+  struct pkt *q;
+  int i;
+
+  for (i = 0; i < p->qlen; i++) {
+    q = &p->queue[(p->qhead + i) % p->qcap].pkt;
+    if (q->seqnum == packet->seqnum && q->acknum == packet->acknum && q->checksum == packet->checksum)
+      return;
+  }
+  if (p->qlen == p->qcap) {
+    bigger = malloc((p->qcap ? 2 * p->qcap : 16) * sizeof(struct waiting));
+    if (bigger == NULL) {
+      printf("memory allocation for the pacing queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < p->qlen; i++)
+      bigger[i] = p->queue[(p->qhead + i) % p->qcap];
+    free(p->queue);
+    p->queue = bigger;
+    p->qcap = p->qcap ? 2 * p->qcap : 16;
+    p->qhead = 0;
+  }
+  p->queue[(p->qhead + p->qlen) % p->qcap].pkt = *packet;
+  p->queue[(p->qhead + p->qlen) % p->qcap].since = get_sim_time();
+  if (packet->buf != NULL)
+    pbuf_ref(packet->buf);
+  p->qlen++;
+}
+
+void pace_init(struct pacer *p, double rtt_rate)
+{
+  if (pace_auto)
+    pace_rate = rtt_rate;
+  while (p->qlen > 0) {
+    pkt_release(&p->queue[p->qhead].pkt);
+    p->qhead = (p->qhead + 1) % p->qcap;
+    p->qlen--;
+  }
+  p->tokens = pace_burst;
+  p->last = get_sim_time();
+  p->timerset = 0;
+  pace_delayed = 0;
+  pace_delay = 0.0;
+}
+
+void pace_send(struct pacer *p, int AorB, const struct pkt packets[], int n)
+{
+  int k;
+
+  if (pace_rate <= 0.0) {
+    tolayer3_batch(AorB, packets, n);
+    return;
+  }
+  refill(p);
+  /* a run of packets the bucket covers goes to layer 3 in one call */
+  for (k = 0; k < n && p->qlen == 0 && p->tokens >= 1.0; k++)
+    p->tokens -= 1.0;
+  if (k > 0)
+    tolayer3_batch(AorB, packets, k);
+  for (; k < n; k++) {
+    if (TRACE > 1)
+      printf("          PACE: packet %d waits for a token\n", packets[k].seqnum);
+    enqueue(p, &packets[k]);
+  }
+  settimer(p, AorB);
+}
+
+void pace_release(struct pacer *p, int AorB)
+{
+  struct waiting *w;
+
+  p->timerset = 0;
+  refill(p);
+  if (p->tokens < 1.0)
+    p->tokens = 1.0;   /* the timer was set for this token; float time can land just short */
+  while (p->qlen > 0 && p->tokens >= 1.0) {
+    p->tokens -= 1.0;
+    w = &p->queue[p->qhead];
+    pace_delayed++;
+    pace_delay += get_sim_time() - w->since;
+    if (TRACE > 1)
+      printf("          PACE: releasing packet %d\n", w->pkt.seqnum);
+    tolayer3_ref(AorB, &w->pkt);
+    pkt_release(&w->pkt);
+    p->qhead = (p->qhead + 1) % p->qcap;
+    p->qlen--;
+  }
+  settimer(p, AorB);
+}
+
+void pace_report(void)
+{
+  if (pace_rate <= 0.0)
+    return;
+  printf("pacing rate:  %f packets per time unit, burst %d \n", pace_rate, pace_burst);
+  printf("number of packets held back by pacing:  %d, average wait %f \n",
+         pace_delayed, pace_delayed > 0 ? pace_delay / pace_delayed : 0.0);
+}
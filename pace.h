@@ -0,0 +1,44 @@
+/* ******************************************************************
+   Sender pacing with a token bucket, shared by gbn.c and sr.c.
+
+   Tokens accrue at pace_rate packets per time unit, up to pace_burst.
+   Sending a packet takes a token; a packet that finds none waits in a
+   queue until pace_release(), run from the emulator's pacing timer,
+   finds one for it.  New packets and retransmissions share the queue,
+   so a whole-window resend leaves at the paced rate too.  With
+   pace_rate 0 the packets go straight to layer 3.  Each sender has a
+   bucket of its own, so the flows of a multi-flow run are paced apart.
+   emulator.h must be included first.
+**********************************************************************/
+
+extern double pace_rate;      /* packets per time unit, 0 for no pacing */
+extern int pace_auto;         /* derive the rate from the protocol's window and RTT */
+extern int pace_burst;        /* bucket depth, in packets */
+
+/* statistics */
+extern __thread int pace_delayed;      /* packets that had to wait for a token */
+extern __thread double pace_delay;     /* summed time they waited */
+
+struct waiting;
+
+struct pacer {
+  double tokens;            /* tokens in the bucket at time last */
+  double last;
+  int timerset;             /* a pace_release() is scheduled */
+  struct waiting *queue;    /* ring of packets waiting for a token */
+  int qcap, qhead, qlen;
+};
+
+/* called from A_init(): rtt_rate is the rate pace_auto selects,
+   one window per round trip.  A zeroed pacer is ready for this. */
+extern void pace_init(struct pacer *p, double rtt_rate);
+
+/* send to A or B (int), packets to send, number of packets: like
+   tolayer3_batch(), at the paced rate */
+extern void pace_send(struct pacer *p, int, const struct pkt[], int);
+
+/* the pacing timer of A or B (int) went off */
+extern void pace_release(struct pacer *p, int);
+
+/* pacing delay at the sender, when pacing is on */
+extern void pace_report(void);
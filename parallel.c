@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "parallel.h"
+
+int parallel_threads = 0;
+
+static const struct lpmodel *model;
+static int nthreads;
+static double until;               /* end of the current window */
+static int stop;                   /* no window left */
+static double *nextev;             /* earliest event left by each thread */
+
+/* a reusable barrier of a mutex and a condition variable (macOS has no
+   pthread_barrier_t): the last thread to arrive starts a new generation,
+   which releases the others.  A window is often short, so a waiter
+   first yields the CPU a few times watching for the new generation
+   before it goes to sleep */
+#define BARRIER_SPINS 64
+
+struct barrier {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count;                       /* threads that wait at it */
+  int waiting;                     /* of those, arrived in this generation */
+  int sleeping;                    /* of those, asleep on cond */
+  atomic_ulong generation;
+};
+
+static struct barrier go, done;
+
+static void barrier_init(struct barrier *b, int count)
+{
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->cond, NULL);
+  b->count = count;
+  b->waiting = b->sleeping = 0;
+  atomic_init(&b->generation, 0);
+}
+
+static void barrier_destroy(struct barrier *b)
+{
+  pthread_mutex_destroy(&b->lock);
+  pthread_cond_destroy(&b->cond);
+}
+
+static void barrier_wait(struct barrier *b)
+{
+  unsigned long generation;
+  int i;
+
+  pthread_mutex_lock(&b->lock);
+  generation = atomic_load_explicit(&b->generation, memory_order_relaxed);
+  if (++b->waiting == b->count) {
+    b->waiting = 0;
+    atomic_store_explicit(&b->generation, generation + 1, memory_order_release);
+    if (b->sleeping > 0)
+      pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+    return;
+  }
+  pthread_mutex_unlock(&b->lock);
+  for (i = 0; i < BARRIER_SPINS; i++) {
+    if (atomic_load_explicit(&b->generation, memory_order_acquire) != generation)
+      return;
+    sched_yield();
+  }
+  pthread_mutex_lock(&b->lock);
+  b->sleeping++;
+  while (atomic_load_explicit(&b->generation, memory_order_acquire) == generation)
+    pthread_cond_wait(&b->cond, &b->lock);
+  b->sleeping--;
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* thread id's block of LPs runs up to the end of the window */
+static void work(int id)
+{
+  int first = (int)((long)model->nlps * id / nthreads);
+  int last = (int)((long)model->nlps * (id + 1) / nthreads);
+  double t, next = PAR_NEVER;
+  int lp;
+
+  for (lp = first; lp < last; lp++) {
+    t = model->advance(lp, until, id);
+    if (t < next)
+      next = t;
+  }
+  nextev[id] = next;
+}
+
+static void *worker(void *arg)
+{
+  int id = (int)(long)arg;
+
+  for (;;) {
+    barrier_wait(&go);
+    if (stop)
+      return NULL;
+    work(id);
+    barrier_wait(&done);
+  }
+}
+
+void parallel_run(const struct lpmodel *m, double start)
+{
+  pthread_t *threads;
+  double next, t;
+  int i;
+
+  model = m;
+  nthreads = parallel_threads < m->nlps ? parallel_threads : m->nlps;
+  if (nthreads < 1)
+    nthreads = 1;
+  threads = malloc(nthreads * sizeof(pthread_t));
+  nextev = malloc(nthreads * sizeof(double));
+  if (threads == NULL || nextev == NULL) {
+    printf("memory allocation for threads failed.");
+    exit(EXIT_FAILURE);
+  }
+  barrier_init(&go, nthreads);
+  barrier_init(&done, nthreads);
+  stop = 0;
+  for (i = 1; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, (void *)(long)i) != 0) {
+      printf("could not start thread %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+
+  /* this thread runs block 0 and the exchanges in between */
+  next = start;
+  while (next < PAR_NEVER) {
+    until = next + m->lookahead;
+    barrier_wait(&go);
+    work(0);
+    barrier_wait(&done);
+    next = m->exchange(until);
+    for (i = 0; i < nthreads; i++)
+      if ((t = nextev[i]) < next)
+        next = t;
+    if (next < PAR_NEVER && m->stop != NULL && m->stop(next))
+      break;
+  }
+  stop = 1;
+  barrier_wait(&go);
+  for (i = 1; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  barrier_destroy(&go);
+  barrier_destroy(&done);
+  free(threads);
+  free(nextev);
+}
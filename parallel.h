@@ -0,0 +1,38 @@
+/* ******************************************************************
+   Conservative parallel simulation in time windows.
+
+   The model is split into logical processes (LPs) that only affect
+   each other through messages taking at least lookahead time units to
+   arrive.  Starting at the earliest pending event t, every LP runs its
+   own events before t + lookahead, on parallel_threads threads, without
+   looking at the others: nothing another LP does in the window can
+   reach it before the window ends.  Then, on one thread, exchange()
+   delivers what the LPs sent, and the next window starts at the
+   earliest event left.  The LPs are split between the threads in
+   fixed contiguous blocks; as each LP's events depend only on its own
+   state and on what exchange() hands it, the results do not depend on
+   the number of threads, and 0 of them (all on the calling thread)
+   gives the same.
+**********************************************************************/
+
+#define PAR_NEVER 1e300       /* time of the next event when there is none */
+
+extern int parallel_threads;  /* threads to run the LPs on, 0 for the caller's */
+
+struct lpmodel {
+  int nlps;
+  double lookahead;
+  /* run LP lp's events before until on the given thread (0 to
+     parallel_threads - 1), return the time of its next event */
+  double (*advance)(int lp, double until, int thread);
+  /* called at the end of each window on one thread: deliver what the
+     LPs sent, return the time of the earliest event that created */
+  double (*exchange)(double until);
+  /* called on that thread before each window but the first, with the
+     time it would start: non-zero ends the run there (NULL for never) */
+  int (*stop)(double next);
+};
+
+/* run the model from its first event at time start until no events
+   are left */
+extern void parallel_run(const struct lpmodel *m, double start);
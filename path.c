@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "path.h"
+
+int path_hops = 0;
+
+/* one direction of a link */
+struct linkdir {
+  double busy;            /* time the transmitter finishes its last packet */
+  double *done;           /* ring of transmission end times of queued packets */
+  int cap, head, len;     /* len includes the packet being transmitted */
+  double since;           /* time len last changed */
+  double area;            /* len integrated over time */
+  int max;                /* longest queue */
+  int sent;               /* packets transmitted */
+  int full;               /* packets dropped for want of queue space */
+  int lost;               /* packets lost on the wire */
+  double wait;            /* summed time packets queued */
+};
+
+struct link {
+  double rate;            /* packets per time unit */
+  double delay;           /* propagation delay */
+  int queue;              /* most packets queued, 0 for no limit */
+  double loss;            /* probability a packet is lost on the wire */
+  struct linkdir dir[2];  /* packets sent by A, by B */
+};
+
+static struct link links[PATH_MAXHOPS];
+
+int path_add(const char *spec)
+{
+  struct link *l;
+  int n;
+
+  if (path_hops == PATH_MAXHOPS)
+    return 0;
+  l = &links[path_hops];
+  l->queue = 0;
+  l->loss = 0.0;
+  n = sscanf(spec, "%lf:%lf:%d:%lf", &l->rate, &l->delay, &l->queue, &l->loss);
+  if (n < 2 || l->rate <= 0.0 || l->delay < 0.0 || l->queue < 0
+      || l->loss < 0.0 || l->loss > 1.0)
+    return 0;
+  path_hops++;
+  return 1;
+}
+
+void path_reset(void)
+{
+  struct linkdir *d;
+  int i, k;
+
+  for (i = 0; i < path_hops; i++)
+    for (k = 0; k < 2; k++) {
+      d = &links[i].dir[k];
+      d->busy = 0.0;
+      d->head = d->len = 0;
+      d->since = d->area = 0.0;
+      d->max = d->sent = d->full = d->lost = 0;
+      d->wait = 0.0;
+    }
+}
+
+/* let the packets whose transmission has ended by now leave the queue */
+static void drain(struct linkdir *d, double now)
+{
+  double t;
+
+  while (d->len > 0 && (t = d->done[d->head]) <= now) {
+    d->area += d->len * (t - d->since);
+    d->since = t;
+    d->head = (d->head + 1) % d->cap;
+    d->len--;
+  }
+  d->area += d->len * (now - d->since);
+  d->since = now;
+}
+
+static void push(struct linkdir *d, double t)
+{
+  double *bigger;
+  int i;
+
+  if (d->len == d->cap) {
+    bigger = malloc((d->cap ? 2 * d->cap : 16) * sizeof(double));
+    if (bigger == NULL) {
+      printf("memory allocation for a link queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < d->len; i++)
+      bigger[i] = d->done[(d->head + i) % d->cap];
+    free(d->done);
+    d->done = bigger;
+    d->cap = d->cap ? 2 * d->cap : 16;
+    d->head = 0;
+  }
+  d->done[(d->head + d->len) % d->cap] = t;
+  d->len++;
+}
+
+double path_enter(int link, int from, double now, double (*rng)(void), double *wait)
+{
+  struct link *l = &links[link];
+  struct linkdir *d = &l->dir[from];
+  double start;
+
+  *wait = 0.0;
+  drain(d, now);
+  if (l->queue > 0 && d->len >= l->queue) {
+    d->full++;
+    return PATH_QUEUEFULL;
+  }
+  start = d->busy > now ? d->busy : now;
+  d->busy = start + 1.0 / l->rate;
+  push(d, d->busy);
+  if (d->len > d->max)
+    d->max = d->len;
+  d->sent++;
+  *wait = start - now;
+  d->wait += *wait;
+  if (l->loss > 0.0 && rng() < l->loss) {
+    d->lost++;
+    return PATH_LOST;
+  }
+  return d->busy + l->delay;
+}
+
+double path_lookahead(void)
+{
+  double t, least = 0.0;
+  int i;
+
+  for (i = 0; i < path_hops; i++) {
+    t = 1.0 / links[i].rate + links[i].delay;
+    if (i == 0 || t < least)
+      least = t;
+  }
+  return least;
+}
+
+void path_report(double now)
+{
+  struct linkdir *d;
+  int i, k;
+
+  for (i = 0; i < path_hops; i++)
+    for (k = 0; k < 2; k++) {
+      d = &links[i].dir[k];
+      drain(d, now);
+      printf("link %d %s:  %d packets sent, %d dropped (queue full), %d lost, "
+             "queue %f average, %d maximum, wait %f \n",
+             i, k == A ? "A->B" : "B->A", d->sent, d->full, d->lost,
+             now > 0.0 ? d->area / now : 0.0, d->max,
+             d->sent > 0 ? d->wait / d->sent : 0.0);
+    }
+}
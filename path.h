@@ -0,0 +1,43 @@
+/* ******************************************************************
+   A linear path of store-and-forward links between A and B.
+
+   A -- link 0 -- R1 -- link 1 -- R2 ... -- link path_hops-1 -- B
+
+   Each link has a rate (packets per time unit), a propagation delay,
+   a queue limit and a loss probability, and a transmitter of its own
+   in each direction: packets from A cross the links in order, packets
+   from B (the ACKs) cross the same links backwards.  A packet waits
+   in the link's FIFO queue until the transmitter is free, takes
+   1 / rate to send, and reaches the next node delay later.  A packet
+   that finds the queue full is dropped; one lost on the wire still
+   took its turn at the transmitter.  Queues never reorder, so packets
+   arrive in the order they were sent.
+
+   With path_hops 0 the emulator's original single-hop medium is used.
+**********************************************************************/
+
+#define PATH_MAXHOPS 16
+
+#define PATH_QUEUEFULL (-1.0)   /* path_enter(): the queue had no room */
+#define PATH_LOST      (-2.0)   /* path_enter(): lost on the wire */
+
+extern int path_hops;         /* links between A and B, 0 for none */
+
+/* add a link after the last one, from "RATE:DELAY[:QUEUE[:LOSS]]"
+   (QUEUE 0 for no limit).  Returns 0 if spec is bad */
+extern int path_add(const char *spec);
+
+/* empty every queue and clear the statistics, at time 0 */
+extern void path_reset(void);
+
+/* a packet sent by A or B (from) enters the given link at time now.
+   Returns when it reaches the far end, or PATH_QUEUEFULL or PATH_LOST,
+   and sets *wait to the time it queued before its transmission */
+extern double path_enter(int link, int from, double now, double (*rng)(void),
+                         double *wait);
+
+/* the least time a packet takes to cross one of the links */
+extern double path_lookahead(void);
+
+/* per-link traffic, drops and queue occupancy up to time now */
+extern void path_report(double now);
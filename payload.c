@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "payload.h"
+
+int payload_mss = 1000;
+
+struct pbuf *pbuf_alloc(int size)
+{
+  struct pbuf *buf;
+
+  buf = malloc(sizeof(struct pbuf) + size);
+  if (buf == NULL) {
+    printf("memory allocation for payload failed.");
+    exit(EXIT_FAILURE);
+  }
+  buf->refs = 1;
+  buf->size = size;
+  return buf;
+}
+
+struct pbuf *pbuf_copy(const struct pbuf *buf)
+{
+  struct pbuf *copy;
+
+  copy = pbuf_alloc(buf->size);
+  memcpy(copy->data, buf->data, buf->size);
+  return copy;
+}
+
+void pbuf_free(struct pbuf *buf)
+{
+  free(buf);
+}
+
+int pkt_segment(struct pkt *p, struct pbuf *buf, int offset, int msglen)
+{
+  memset(p->payload, 0, sizeof(p->payload));
+  p->offset = offset;
+  p->msglen = msglen;
+  p->length = msglen - offset < payload_mss ? msglen - offset : payload_mss;
+  p->buf = pbuf_ref(buf);
+  return p->length;
+}
+
+void deliver_segment(struct reassembly *r, int AorB, const struct pkt *packet)
+{
+  struct pbuf *copy;
+
+  if (packet->buf == NULL) {
+    tolayer5(AorB, packet->payload);
+    return;
+  }
+  if (packet->offset == 0) {
+    r->next = 0;                 /* first segment starts a new message */
+    if (r->buf != NULL)
+      pbuf_unref(r->buf);
+    r->buf = pbuf_ref(packet->buf);
+    r->own = 0;
+  }
+  if (packet->offset != r->next) {
+    if (TRACE > 0)
+      printf("----%c: segment at %d out of order, expected %d\n",
+             AorB == A ? 'A' : 'B', packet->offset, r->next);
+    return;
+  }
+  if (packet->msglen != r->buf->size) {
+    if (TRACE > 0)
+      printf("----%c: segment of a %d byte message in one of %d bytes\n",
+             AorB == A ? 'A' : 'B', packet->msglen, r->buf->size);
+    return;
+  }
+  if (packet->buf != r->buf) {
+    if (!r->own) {
+      copy = pbuf_copy(r->buf);
+      pbuf_unref(r->buf);
+      r->buf = copy;
+      r->own = 1;
+    }
+    memcpy(r->buf->data + packet->offset, packet->buf->data + packet->offset, packet->length);
+  }
+  r->next += packet->length;
+  if (r->next == packet->msglen) {
+    /* every byte of the message has arrived: deliver the buffer */
+    tolayer5_buf(AorB, r->buf, packet->msglen);
+    pbuf_unref(r->buf);
+    r->buf = NULL;
+    r->next = 0;
+  }
+}
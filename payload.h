@@ -0,0 +1,62 @@
+/* ******************************************************************
+   Variable-size payloads in shared, reference-counted buffers.
+
+   A message larger than the classic 20 bytes carries its bytes in a
+   pbuf.  Layer 4 cuts it into segments of at most payload_mss bytes;
+   every segment is a (buf, offset, length) view of the same pbuf, so
+   neither the protocols nor the emulator copy payload bytes - they only
+   take and drop references.  The emulator copies a buffer only when it
+   corrupts a packet (copy on write).
+   emulator.h must be included first.
+**********************************************************************/
+
+struct pbuf {
+  int refs;          /* references held by messages, packets and events */
+  int size;          /* number of bytes in data */
+  char data[];
+};
+
+extern int payload_mss;   /* largest segment a packet carries, in bytes */
+
+extern struct pbuf *pbuf_alloc(int size);
+extern struct pbuf *pbuf_copy(const struct pbuf *buf);
+
+static inline struct pbuf *pbuf_ref(struct pbuf *buf)
+{
+  buf->refs++;
+  return buf;
+}
+
+extern void pbuf_free(struct pbuf *buf);
+
+static inline void pbuf_unref(struct pbuf *buf)
+{
+  if (--buf->refs == 0)
+    pbuf_free(buf);
+}
+
+/* make p the segment of a message starting at offset, returns its length */
+extern int pkt_segment(struct pkt *p, struct pbuf *buf, int offset, int msglen);
+
+/* drop the packet's reference to its payload buffer, if it has one */
+static inline void pkt_release(struct pkt *p)
+{
+  if (p->buf != NULL) {
+    pbuf_unref(p->buf);
+    p->buf = NULL;
+  }
+}
+
+/* receiver side reassembly of segments arriving in order.  The
+   segments of a message normally share one buffer, which is delivered
+   as it is; a segment in a buffer of its own (rebuilt by FEC) has its
+   bytes copied into a private copy of the message */
+struct reassembly {
+  int next;          /* offset of the next segment expected */
+  struct pbuf *buf;  /* the message being received, or NULL */
+  int own;           /* buf is the private copy */
+};
+
+/* hand a packet's data to layer 5 at AorB: classic payloads directly,
+   segments once the whole message has arrived */
+extern void deliver_segment(struct reassembly *r, int AorB, const struct pkt *packet);
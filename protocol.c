@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "gbn.h"
+#include "sr.h"
+
+/* weak, so that a build without some of the protocol files still links;
+   the descriptors of those left out are NULL */
+extern const struct protocol gbn_protocol __attribute__((weak));
+extern const struct protocol sr_protocol __attribute__((weak));
+extern const struct protocol sr1_protocol __attribute__((weak));
+
+static const struct protocol *const registry[] = {
+  &gbn_protocol, &sr_protocol, &sr1_protocol
+};
+
+#define NREGISTRY ((int)(sizeof(registry) / sizeof(registry[0])))
+
+int protocol_specs = 0;
+const struct protocol *protocol_spec[PROTOCOL_MAXSPECS];
+
+const struct protocol *protocol_find(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NREGISTRY; i++)
+    if (registry[i] != NULL && strcmp(registry[i]->name, name) == 0)
+      return registry[i];
+  return NULL;
+}
+
+int protocol_add(const char *name)
+{
+  const struct protocol *p = protocol_find(name);
+
+  if (p == NULL || protocol_specs == PROTOCOL_MAXSPECS)
+    return 0;
+  protocol_spec[protocol_specs++] = p;
+  return 1;
+}
+
+void protocol_require(const struct protocol *p, int want)
+{
+  static const struct {
+    int cap;
+    const char *option;
+  } options[] = {
+    { PROTO_SEGMENTS, "--msgsize" }, { PROTO_FEC, "--fec" },
+    { PROTO_NACK, "--nack" }, { PROTO_PACE, "--pace" }
+  };
+  int i;
+
+  for (i = 0; i < (int)(sizeof(options) / sizeof(options[0])); i++)
+    if ((want & options[i].cap) && !(p->caps & options[i].cap)) {
+      printf("protocol %s does not support %s\n", p->name, options[i].option);
+      exit(EXIT_FAILURE);
+    }
+}
+
+const struct protocol *protocol_of(int flow)
+{
+  int i;
+
+  if (protocol_specs > 0)
+    return protocol_spec[flow % protocol_specs];
+  for (i = 0; i < NREGISTRY; i++)
+    if (registry[i] != NULL)
+      return registry[i];
+  printf("no protocol linked in\n");
+  exit(EXIT_FAILURE);
+}
+
+void protocol_names(void)
+{
+  int i;
+
+  for (i = 0; i < NREGISTRY; i++)
+    if (registry[i] != NULL)
+      printf(" %s", registry[i]->name);
+  printf("\n");
+}
@@ -0,0 +1,64 @@
+/* ******************************************************************
+   The protocols one binary can run, chosen at run time.
+
+   Each protocol file (gbn.c, sr.c, sr1.c) keeps its callbacks to
+   itself and exports a descriptor naming them.  The emulator and the
+   transports call the protocol of each flow through its descriptor,
+   so a build can link in any number of protocols and --protocol picks
+   one per run, or one per flow: each --protocol gives one name, and
+   flow i runs name number i modulo the number given.  A build links in
+   any subset of the protocol files; the registry only lists those
+   present.  emulator.h must be included first.
+**********************************************************************/
+
+#define PROTOCOL_MAXSPECS 16    /* --protocol options */
+
+/* what a protocol does beyond the Kurose service of 20 byte messages,
+   each the option that needs it */
+#define PROTO_SEGMENTS 1      /* messages of any size, cut into segments (--msgsize) */
+#define PROTO_FEC      2      /* parity packets (--fec) */
+#define PROTO_NACK     4      /* B asks for missing packets (--nack) */
+#define PROTO_PACE     8      /* A sends through a token bucket (--pace) */
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+
+struct protocol {
+  const char *name;
+  void (*A_init)(void);
+  void (*B_init)(void);
+  /* the caller hands over a view of the message or packet it holds,
+     which is only valid during the call */
+  void (*A_output)(const struct msg *);
+  void (*A_input)(const struct pkt *);
+  void (*B_input)(const struct pkt *);
+  void (*A_timerinterrupt)(void);
+  void (*B_timerinterrupt)(void);
+  void (*B_output)(struct msg);
+  /* multi-flow runs.  flows(n) asks for n copies of the protocol's
+     state, in place of those of an earlier simulation, then bind(i)
+     selects the copy of flow i for the callbacks that follow.  NULL for a protocol with a single copy in statics,
+     which can run one flow only */
+  void (*flows)(int n);
+  void (*bind)(int flow);
+  int caps;                   /* PROTO_ flags */
+};
+
+extern int protocol_specs;                      /* --protocol options given */
+extern const struct protocol *protocol_spec[];  /* the protocols they name */
+
+/* the linked-in protocol called name, NULL if there is none */
+extern const struct protocol *protocol_find(const char *name);
+
+/* add a --protocol option, return 0 if no such protocol is linked in */
+extern int protocol_add(const char *name);
+
+/* exit with a message if p lacks one of the capabilities in want, which
+   the options given ask for */
+extern void protocol_require(const struct protocol *p, int want);
+
+/* the protocol flow runs: its --protocol, or the first linked in */
+extern const struct protocol *protocol_of(int flow);
+
+/* print the names of the linked-in protocols */
+extern void protocol_names(void);
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "replicate.h"
+
+#define MINREPS  3        /* never stop on fewer replications than this */
+#define BASESEED 9999     /* seed of the first replication */
+#define NMETRICS 3
+
+int replicate_max = 0;
+int replicate_jobs = 0;
+double replicate_precision = 0.05;
+
+static const char *metricnames[NMETRICS] = {
+  "goodput (msgs/time unit)",
+  "retransmissions per message",
+  "latency (time units)"
+};
+
+/* two sided 95% Student t quantiles for 1..30 degrees of freedom */
+static const double t95[30] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double tquantile(int df)
+{
+  if (df <= 30)
+    return t95[df - 1];
+  return 1.960 + 2.4 / df;   /* close enough to the tail of the table */
+}
+
+static double metric(const struct repsample *s, int m)
+{
+  if (m == 0)
+    return s->goodput;
+  else if (m == 1)
+    return s->retx_per_msg;
+  return s->latency;
+}
+
+/* mean and confidence half-width of metric m over the first n samples */
+static void interval(const struct repsample *s, int n, int m, double *mean, double *half)
+{
+  double sum = 0.0, sq = 0.0, d;
+  int i;
+
+  for (i = 0; i < n; i++)
+    sum += metric(&s[i], m);
+  *mean = sum / n;
+  for (i = 0; i < n; i++) {
+    d = metric(&s[i], m) - *mean;
+    sq += d * d;
+  }
+  *half = n > 1 ? tquantile(n - 1) * sqrt(sq / (n - 1) / n) : HUGE_VAL;
+}
+
+/* replications among the first n that measured nothing after warm-up */
+static int empty(const struct repsample *s, int n)
+{
+  int i, k = 0;
+
+  for (i = 0; i < n; i++)
+    k += s[i].measured <= 0;
+  return k;
+}
+
+/* a zero mean, or a replication with nothing to measure, is not
+   precise however narrow the interval */
+static int precise(const struct repsample *s, int n)
+{
+  double mean, half;
+  int m;
+
+  if (n < MINREPS || empty(s, n) > 0)
+    return 0;
+  for (m = 0; m < NMETRICS; m++) {
+    interval(s, n, m, &mean, &half);
+    if (mean == 0.0 || half > replicate_precision * fabs(mean))
+      return 0;
+  }
+  return 1;
+}
+
+/* start replication rep in a child writing its sample down fd[1] */
+static pid_t spawn(int rep, int fd[2], void (*run)(unsigned int, struct repsample *))
+{
+  struct repsample out;
+  pid_t pid;
+
+  if (pipe(fd) < 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    run(BASESEED + rep, &out);
+    if (write(fd[1], &out, sizeof(out)) != sizeof(out))
+      _exit(EXIT_FAILURE);
+    _exit(EXIT_SUCCESS);
+  }
+  close(fd[1]);
+  return pid;
+}
+
+void replicate(void (*run)(unsigned int seed, struct repsample *out))
+{
+  struct repsample *samples;
+  pid_t *pids;
+  int *fds, *done;
+  int fd[2];
+  int jobs, next = 0, running = 0, ready = 0, status, i, m;
+  double mean, half;
+  pid_t pid;
+
+  jobs = replicate_jobs > 0 ? replicate_jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+  samples = malloc(replicate_max * sizeof(struct repsample));
+  pids = malloc(replicate_max * sizeof(pid_t));
+  fds = malloc(replicate_max * sizeof(int));
+  done = calloc(replicate_max, sizeof(int));
+  if (samples == NULL || pids == NULL || fds == NULL || done == NULL) {
+    printf("memory allocation for replications failed.");
+    exit(EXIT_FAILURE);
+  }
+
+  /* samples are used strictly in seed order, so the stopping point
+     does not depend on which worker happens to finish first */
+  while (!precise(samples, ready) && ready < replicate_max) {
+    while (running < jobs && next < replicate_max) {
+      pids[next] = spawn(next, fd, run);
+      fds[next] = fd[0];
+      next++;
+      running++;
+    }
+    pid = wait(&status);
+    if (pid < 0) {
+      perror("wait");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < next && pids[i] != pid; i++)
+      ;
+    if (i == next)
+      continue;
+    running--;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        read(fds[i], &samples[i], sizeof(struct repsample)) != sizeof(struct repsample)) {
+      printf("replication %d (seed %d) failed\n", i, BASESEED + i);
+      exit(EXIT_FAILURE);
+    }
+    close(fds[i]);
+    done[i] = 1;
+    while (ready < next && done[ready])
+      ready++;
+  }
+
+  /* replications still running are no longer needed */
+  for (i = 0; i < next; i++)
+    if (!done[i]) {
+      kill(pids[i], SIGKILL);
+      waitpid(pids[i], &status, 0);
+      close(fds[i]);
+    }
+
+  printf("\n-----  Replication summary (%d runs, %d at a time) -------- \n", ready, jobs);
+  printf("%-30s %14s %14s %10s\n", "metric", "mean", "95% CI +/-", "rel.");
+  for (m = 0; m < NMETRICS; m++) {
+    interval(samples, ready, m, &mean, &half);
+    printf("%-30s %14.6f %14.6f %9.2f%%\n", metricnames[m], mean, half,
+           mean != 0.0 ? 100.0 * half / fabs(mean) : 0.0);
+  }
+  if (empty(samples, ready) > 0)
+    printf("Warning: %d of %d runs delivered no messages after --warmup\n",
+           empty(samples, ready), ready);
+  if (precise(samples, ready))
+    printf("target relative precision %.2f%% reached\n", 100.0 * replicate_precision);
+  else
+    printf("target relative precision %.2f%% NOT reached after %d runs\n",
+           100.0 * replicate_precision, ready);
+
+  free(samples);
+  free(pids);
+  free(fds);
+  free(done);
+}
@@ -0,0 +1,24 @@
+/* ******************************************************************
+   Replicated runs with confidence-interval stopping.
+
+   Independent replications of one configuration (seeds 9999, 10000,
+   ...) run in forked worker processes, several at a time.  After each
+   replication the mean and 95% confidence interval of every metric is
+   updated, and replication stops as soon as all half-widths are within
+   the requested relative precision of their means.
+**********************************************************************/
+
+/* steady-state metrics of one replication (after warm-up removal) */
+struct repsample {
+  double goodput;        /* messages delivered per time unit */
+  double retx_per_msg;   /* packets resent per message delivered */
+  double latency;        /* mean layer 5 to layer 5 delay */
+  int measured;          /* messages delivered after warm-up */
+};
+
+extern int replicate_max;           /* most replications to run, 0 = replication off */
+extern int replicate_jobs;          /* replications run at once, 0 = one per core */
+extern double replicate_precision;  /* target half-width / mean */
+
+/* run replications of run(), which simulates one seed and fills in a sample */
+extern void replicate(void (*run)(unsigned int seed, struct repsample *out));
@@ -0,0 +1,519 @@
+/* ******************************************************************
+   REAL-TIME THREADS: A and B running at the same time.
+
+   Runs the same protocol code as the emulator (it provides the same
+   student-callable routines) in real time, with A and B each running
+   an event loop on a thread of its own, pinned to a CPU:
+   - tolayer3() packs the packet into the sender's queue, a lock-free
+     ring (spsc.h) to the other thread.  A full queue drops the packet
+   - the queue is also the delay and loss stage: the sender applies the
+     loss and corruption probabilities and stamps each packet with the
+     time it may be taken off, D plus up to JITTER time units later
+     (--delay), never before the packet ahead of it
+   - each thread keeps its timers - the protocol's timer, the pacing
+     timer and, for A, the next arrival from layer 5 - on a hashed
+     timer wheel of its own, which it turns every time round its loop
+
+   Time is real time since the start of the run, in units of --unit
+   microseconds (1000 by default).  The report adds, for each thread,
+   its CPU time and the fraction of the run it spent busy handling
+   events rather than polling for them: a thread near 100% is the one
+   that limits the throughput.  What is not about the queues and the
+   wheels is shared with the other transports, in transport.c.
+
+   Linux only: pthread_setaffinity_np() and the thread CPU clock.
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
+#include "wire.h"
+#include "spsc.h"
+#include "transport.h"
+
+#define BATCH    64        /* packets taken off a queue at a time */
+#define IDLE_NS  5000000000ULL   /* a run with nothing happening for this long ends */
+#define WHEEL_SLOTS 256    /* slots of a timer wheel, a power of two */
+
+/* a queued packet: when it may be taken off, then its bytes */
+struct qhdr {
+  unsigned long long due;   /* ns */
+  int len;
+};
+
+/*************************** TIMER WHEELS ****************************/
+/* A hashed timing wheel: a timer due in tick t waits in slot t modulo */
+/* WHEEL_SLOTS, and turning the wheel to now runs every slot passed    */
+/* since the last turn, firing the timers whose tick it is.  Starting  */
+/* and stopping a timer are O(1) whatever the number of timers.        */
+/**********************************************************************/
+
+struct wtimer {
+  unsigned long long tick;  /* tick it fires in */
+  struct wtimer *next, **prev;   /* in its slot; prev NULL when not set */
+  void (*fire)(struct wtimer *);
+};
+
+struct wheel {
+  unsigned long long origin;     /* time of tick 0, ns */
+  unsigned long long done;       /* ticks turned so far */
+  struct wtimer *slot[WHEEL_SLOTS];
+  int set;                       /* timers on the wheel */
+};
+
+static unsigned long long tick_ns = 10000;   /* a tick, --tick */
+
+/* set t to fire once the wheel has turned past time at (ns) */
+static void wheel_add(struct wheel *w, struct wtimer *t, unsigned long long at)
+{
+  struct wtimer **s;
+
+  t->tick = at > w->origin ? (at - w->origin + tick_ns - 1) / tick_ns : 0;
+  if (t->tick <= w->done)        /* already due: the next turn fires it */
+    t->tick = w->done + 1;
+  s = &w->slot[t->tick & (WHEEL_SLOTS - 1)];
+  t->next = *s;
+  if (*s != NULL)
+    (*s)->prev = &t->next;
+  t->prev = s;
+  *s = t;
+  w->set++;
+}
+
+static void wheel_del(struct wheel *w, struct wtimer *t)
+{
+  if (t->prev == NULL)
+    return;
+  *t->prev = t->next;
+  if (t->next != NULL)
+    t->next->prev = t->prev;
+  t->prev = NULL;
+  w->set--;
+}
+
+/* turn the wheel to time now, firing the timers due; returns how many */
+static int wheel_turn(struct wheel *w, unsigned long long now)
+{
+  unsigned long long to = (now - w->origin) / tick_ns;
+  struct wtimer *t;
+  int n = 0;
+
+  if (w->set == 0) {             /* nothing to fire on the way */
+    w->done = to > w->done ? to : w->done;
+    return 0;
+  }
+  while (w->done < to) {
+    w->done++;
+    /* a fired timer may stop or start others, so look again each time */
+    for (;;) {
+      for (t = w->slot[w->done & (WHEEL_SLOTS - 1)]; t != NULL && t->tick != w->done; t = t->next)
+        ;
+      if (t == NULL)
+        break;
+      wheel_del(w, t);
+      t->fire(t);
+      n++;
+    }
+  }
+  return n;
+}
+
+/****************************** THE RUN ******************************/
+
+/* what a thread counted, added up for the report */
+struct tally {
+  int total_ACKs_received, packets_resent, new_ACKs, packets_received;
+  int window_full, nacks_sent, packets_resent_nack;
+  int fec_data_sent, fec_parity_sent, fec_recovered, pace_delayed;
+  double pace_delay;
+  int rcvbuf_released, recoveries, held_max;
+  double rcvbuf_delay, recoverysum;
+  long long packets_sent, packets_lost, packets_corrupt, queuefull;
+  long long packets_read, packets_bad, bytes_delivered;
+  int packets_timeout;
+  long long polls, yields;
+  double cpu, busy;              /* seconds */
+};
+
+/* parameters, besides transport.h's */
+static double delay_min = 0.0;    /* queue delay and jitter, time units, --delay */
+static double delay_jitter = 0.0;
+static int spin = 0;              /* never yield the CPU */
+static int cpu[2] = {0, 1};       /* where A and B run, --cpus */
+static unsigned queuesize = 1024; /* slots per queue, a power of two */
+
+/* shared between the threads */
+static struct spsc *queue[2];     /* packets sent by A, by B */
+static atomic_int delivered_all;  /* messages B handed to layer 5 */
+static atomic_int stop;           /* A has seen everything delivered */
+static struct tally tallies[2];   /* each thread's, once it is done */
+
+/* each thread's own */
+static __thread int side;         /* A or B */
+static __thread struct wheel wheel;
+static __thread struct wtimer timer, pacetimer, arrivaltimer;
+static __thread struct pacer *pacing;
+static __thread unsigned long long lastdue;   /* of the last packet queued */
+static __thread long long queuefull, polls, yields;
+static __thread double busy;      /* ns spent handling events */
+
+/* A's layer 5 */
+static unsigned long long nextarrival;
+
+static void setup(void)
+{
+  size_t bytes = sizeof(struct qhdr) + wire_size();
+  int i;
+
+  for (i = A; i <= B; i++) {
+    if (posix_memalign((void **)&queue[i], SPSC_CACHELINE, spsc_bytes(queuesize, bytes)) != 0) {
+      printf("memory allocation for a queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    spsc_init(queue[i], queuesize, bytes);
+  }
+  stamp = allocate((size_t)(nsimmax + 1) * sizeof(stamp[0]), "time stamps");
+  published = &delivered_all;
+}
+
+/*************************** THE QUEUES ******************************/
+
+/* put a packet sent by AorB into its queue, through the loss stage */
+void transmit(int AorB, const struct pkt *packet)
+{
+  struct qhdr *h;
+  char *s;
+
+  if (lost(AorB))
+    return;
+  if ((s = spsc_reserve(queue[AorB])) == NULL) {
+    queuefull++;
+    if (TRACE>0)
+      printf("          TOLAYER3: queue full, packet dropped\n");
+    return;
+  }
+  h = (struct qhdr *)s;
+  s += sizeof(struct qhdr);
+  h->len = wire_pack(s, packet);
+  corrupt(AorB, s);
+  h->due = 0;
+  if (delay_min > 0.0 || delay_jitter > 0.0) {   /* the delay stage keeps the order */
+    h->due = now() + units_to_ns(delay_min + delay_jitter * uniform01());
+    if (h->due < lastdue)
+      h->due = lastdue;
+    lastdue = h->due;
+  }
+  spsc_publish(queue[AorB]);
+}
+
+/* hand the packets that are due by t to the protocol, at most BATCH;
+   returns how many there were */
+static int receive(unsigned long long t)
+{
+  struct spsc *q = queue[(side + 1) % 2];
+  const struct qhdr *h;
+  unsigned n, i;
+
+  n = spsc_ready(q, BATCH);
+  for (i = 0; i < n; i++) {
+    h = (const struct qhdr *)spsc_slot(q, i);
+    if (h->due > t)               /* still in the delay stage */
+      break;
+    input(side, (const char *)(h + 1), h->len);
+  }
+  if (i > 0)
+    spsc_release(q, i);
+  return i;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void stoptimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n", get_sim_time());
+  if (timer.prev == NULL) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  wheel_del(&wheel, &timer);
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n", get_sim_time());
+  if (timer.prev != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  wheel_add(&wheel, &timer, now() + units_to_ns(increment));
+}
+
+void startpacetimer(int AorB, double increment, struct pacer *pacer)
+{
+  pacing = pacer;
+  wheel_del(&wheel, &pacetimer);
+  wheel_add(&wheel, &pacetimer, now() + units_to_ns(increment));
+}
+
+/***************************** THE THREADS ****************************/
+
+static void fire_timer(struct wtimer *t)
+{
+  packets_timeout++;
+  if (side == A)
+    proto->A_timerinterrupt();
+  else
+    proto->B_timerinterrupt();
+}
+
+static void fire_pace(struct wtimer *t)
+{
+  pace_release(pacing, side);
+}
+
+/* the messages due from layer 5, and the timer for the next */
+static void fire_arrival(struct wtimer *t)
+{
+  unsigned long long at = now();
+
+  while (nsim < nsimmax && nextarrival <= at) {
+    offer();
+    nextarrival += interarrival();
+  }
+  if (nsim < nsimmax)
+    wheel_add(&wheel, &arrivaltimer, nextarrival);
+}
+
+static void pin(int AorB)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu[AorB], &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    printf("could not pin %c to CPU %d, running unpinned\n", AorB == A ? 'A' : 'B', cpu[AorB]);
+}
+
+/* keep what this thread counted for the report */
+static void tallyup(struct tally *t)
+{
+  struct timespec ts;
+
+  t->total_ACKs_received = total_ACKs_received;
+  t->packets_resent = packets_resent;
+  t->new_ACKs = new_ACKs;
+  t->packets_received = packets_received;
+  t->window_full = window_full;
+  t->nacks_sent = nacks_sent;
+  t->packets_resent_nack = packets_resent_nack;
+  t->fec_data_sent = fec_data_sent;
+  t->fec_parity_sent = fec_parity_sent;
+  t->fec_recovered = fec_recovered;
+  t->pace_delayed = pace_delayed;
+  t->pace_delay = pace_delay;
+  t->rcvbuf_released = rcvbuf_released;
+  t->recoveries = recoveries;
+  t->held_max = held_max;
+  t->rcvbuf_delay = rcvbuf_delay;
+  t->recoverysum = recoverysum;
+  t->packets_sent = packets_sent;
+  t->packets_lost = packets_lost;
+  t->packets_corrupt = packets_corrupt;
+  t->queuefull = queuefull;
+  t->packets_read = packets_read;
+  t->packets_bad = packets_bad;
+  t->bytes_delivered = bytes_delivered;
+  t->packets_timeout = packets_timeout;
+  t->polls = polls;
+  t->yields = yields;
+  t->busy = busy / 1e9;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  t->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one side's event loop.  A's runs until B has delivered every message
+   A accepted, then tells B's to stop */
+static void *run(void *arg)
+{
+  unsigned long long t, t0, last;
+  int work, seen = 0, d;
+
+  side = (int)(long)arg;
+  pin(side);
+  transport_seed(9999 + side);
+  wheel.origin = start;
+  timer.fire = fire_timer;
+  pacetimer.fire = fire_pace;
+  arrivaltimer.fire = fire_arrival;
+  if (side == A) {
+    proto->A_init();
+    if (!saturate) {
+      nextarrival = now() + interarrival();
+      wheel_add(&wheel, &arrivaltimer, nextarrival);
+    }
+  }
+  else
+    proto->B_init();
+  last = now();
+  for (;;) {
+    polls++;
+    t0 = now();
+    work = receive(t0);
+    work += wheel_turn(&wheel, t0);
+    if (side == A && saturate)
+      while (nsim < nsimmax && offer())
+        work++;
+    t = now();
+    if (work > 0) {
+      busy += t - t0;
+      last = t;
+    }
+    if (side == B) {
+      if (atomic_load_explicit(&stop, memory_order_acquire))
+        break;
+    }
+    else {
+      d = atomic_load_explicit(&delivered_all, memory_order_acquire);
+      if (nsim == nsimmax && d >= accepted)
+        break;
+      if (d != seen) {
+        seen = d;
+        last = t;
+      }
+      else if (t - last > IDLE_NS) {
+        printf("nothing happened for %llu ms, giving up\n", IDLE_NS / 1000000);
+        break;
+      }
+    }
+    if (work == 0 && !spin) {
+      yields++;
+      sched_yield();
+    }
+  }
+  if (side == A)
+    atomic_store_explicit(&stop, 1, memory_order_release);
+  tallyup(&tallies[side]);
+  return NULL;
+}
+
+/************************** REPORT **************************/
+
+static void report(double wall)
+{
+  const struct tally *a = &tallies[A], *b = &tallies[B];
+  int i;
+
+  /* the protocol's statistics, each counted by one side */
+  window_full = a->window_full;
+  new_ACKs = a->new_ACKs;
+  packets_resent = a->packets_resent;
+  packets_resent_nack = a->packets_resent_nack;
+  packets_received = b->packets_received;
+  nacks_sent = b->nacks_sent;
+  fec_data_sent = a->fec_data_sent;
+  fec_parity_sent = a->fec_parity_sent;
+  fec_recovered = b->fec_recovered;
+  pace_delayed = a->pace_delayed + b->pace_delayed;
+  pace_delay = a->pace_delay + b->pace_delay;
+  bytes_delivered = b->bytes_delivered;
+  rcvbuf_released = b->rcvbuf_released;
+  rcvbuf_delay = b->rcvbuf_delay;
+  recoveries = b->recoveries;
+  recoverysum = b->recoverysum;
+  held_max = b->held_max;
+
+  transport_report("Real-time", wall);
+  printf("packets sent by A:  %lld, lost %lld, corrupted %lld, dropped on a full queue %lld \n",
+         a->packets_sent, a->packets_lost, a->packets_corrupt, a->queuefull);
+  printf("packets sent by B:  %lld, lost %lld, corrupted %lld, dropped on a full queue %lld \n",
+         b->packets_sent, b->packets_lost, b->packets_corrupt, b->queuefull);
+  printf("packets per second:  %f \n", wall > 0.0 ? (a->packets_sent + b->packets_sent) / wall : 0.0);
+  printf("timer interrupts:  %d at A, %d at B \n", a->packets_timeout, b->packets_timeout);
+  for (i = A; i <= B; i++)
+    printf("thread %c (CPU %d):  %f s CPU, busy %.1f%% of the run, %lld polls, %lld yields \n",
+           i == A ? 'A' : 'B', cpu[i], tallies[i].cpu, wall > 0.0 ? 100.0 * tallies[i].busy / wall : 0.0,
+           tallies[i].polls, tallies[i].yields);
+  printf("CPU time per message delivered:  %f us \n",
+         messages_delivered > 0 ? (a->cpu + b->cpu) * 1e6 / messages_delivered : 0.0);
+}
+
+/* command line options, given before the interactive parameters */
+static void parseargs(int argc, char *argv[])
+{
+  int i;
+  const char *v;
+
+  for (i = 1; i < argc; i++) {
+    if ((v = optval(argv[i], "--tick")) != NULL) {
+      if ((tick_ns = atol(v) * 1000ULL) < 1000) {
+        printf("bad timer wheel tick: %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if ((v = optval(argv[i], "--delay")) != NULL) {
+      if (sscanf(v, "%lf:%lf", &delay_min, &delay_jitter) < 1 || delay_min < 0.0 || delay_jitter < 0.0) {
+        printf("bad delay (D[:JITTER]): %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if ((v = optval(argv[i], "--cpus")) != NULL) {
+      if (sscanf(v, "%d,%d", &cpu[A], &cpu[B]) != 2 || cpu[A] < 0 || cpu[B] < 0
+          || cpu[A] >= CPU_SETSIZE || cpu[B] >= CPU_SETSIZE) {
+        printf("bad CPUs (A,B): %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if ((v = optval(argv[i], "--queue")) != NULL) {
+      queuesize = atoi(v);
+      if (queuesize < 2 || (queuesize & (queuesize - 1)) != 0) {
+        printf("bad queue size (a power of two): %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "--spin") == 0)
+      spin = 1;
+    else if (!transport_option(argv[i])) {
+      printf("unknown option: %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[2];
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  checksum_init();
+  if (ncpus > 0)                 /* by default A and B get a CPU each if there are two */
+    cpu[B] = 1 % ncpus;
+  parseargs(argc, argv);
+  proto = protocol_of(0);
+  readparams("Real-Time Threads");
+  setup();
+  start = now();
+  for (i = A; i <= B; i++)
+    if (pthread_create(&threads[i], NULL, run, (void *)(long)i) != 0) {
+      printf("could not start thread %c\n", i == A ? 'A' : 'B');
+      exit(EXIT_FAILURE);
+    }
+  for (i = A; i <= B; i++)
+    pthread_join(threads[i], NULL);
+  report((now() - start) / 1e9);
+  return EXIT_SUCCESS;
+}
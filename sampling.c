@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include "sampling.h"
+
+/* number of packets without the event before the next one that has it */
+long skip_gap(double p, double (*rng)(void))
+{
+  double u, gap;
+
+  if (p <= 0.0)
+    return LONG_MAX;
+  if (p >= 1.0)
+    return 0;
+  u = 1.0 - rng();               /* uniform on (0,1] as far as rng allows */
+  if (u <= 0.0)
+    u = 1e-300;
+  gap = floor(log(u) / log1p(-p));
+  return gap >= (double)LONG_MAX ? LONG_MAX : (long)gap;
+}
+
+void skip_init(struct skipper *s, double p, double (*rng)(void))
+{
+  s->p = p;
+  s->countdown = skip_gap(p, rng);
+}
+
+/************************ self test *************************/
+
+#define BLOCKS   4000     /* blocks of packets per sampler */
+#define BLOCKLEN 500      /* packets per block */
+#define MINBIN   10       /* merge histogram bins until they hold this many */
+
+/* upper 0.1% point of chi-square with df degrees of freedom (Wilson-Hilferty) */
+static double chi2crit(int df)
+{
+  double h = 2.0 / (9.0 * df);
+  double c = 1.0 - h + 3.090 * sqrt(h);
+
+  return df * c * c * c;
+}
+
+/* two-sample chi-square test on the distribution of losses per block */
+static int compare(double p, double (*rng)(void))
+{
+  static int hb[BLOCKLEN + 1], hg[BLOCKLEN + 1];
+  struct skipper s;
+  long nb = 0, ng = 0;
+  int blk, i, k, a, b, df = -1;
+  double chi2 = 0.0;
+
+  for (i = 0; i <= BLOCKLEN; i++)
+    hb[i] = hg[i] = 0;
+  skip_init(&s, p, rng);
+  for (blk = 0; blk < BLOCKS; blk++) {
+    for (a = b = i = 0; i < BLOCKLEN; i++) {
+      a += rng() < p;
+      b += skip_next(&s, rng);
+    }
+    hb[a]++;
+    hg[b]++;
+    nb += a;
+    ng += b;
+  }
+
+  for (i = 0; i <= BLOCKLEN; i = k) {
+    for (a = b = 0, k = i; k <= BLOCKLEN && a + b < MINBIN; k++) {
+      a += hb[k];
+      b += hg[k];
+    }
+    if (a + b == 0)
+      continue;
+    chi2 += (double)(a - b) * (a - b) / (a + b);
+    df++;
+  }
+
+  printf("p=%-6g bernoulli rate %.6f  geometric rate %.6f  chi2 %8.2f (df %d, limit %.2f)  %s\n",
+         p, (double)nb / (BLOCKS * BLOCKLEN), (double)ng / (BLOCKS * BLOCKLEN),
+         chi2, df, df > 0 ? chi2crit(df) : 0.0,
+         (df <= 0 || chi2 <= chi2crit(df)) ? "ok" : "FAIL");
+  return df > 0 && chi2 > chi2crit(df);
+}
+
+int sampling_selftest(double (*rng)(void))
+{
+  static const double probs[] = { 0.0, 0.001, 0.01, 0.05, 0.1, 0.3, 0.7, 1.0 };
+  int i, failed = 0;
+
+  printf("-----  Bernoulli vs geometric loss sampling, %d blocks of %d packets -------- \n",
+         BLOCKS, BLOCKLEN);
+  for (i = 0; i < (int)(sizeof(probs) / sizeof(probs[0])); i++)
+    failed += compare(probs[i], rng);
+  return failed;
+}
@@ -0,0 +1,35 @@
+/* ******************************************************************
+   Geometric skip-ahead sampling of per-packet Bernoulli events.
+
+   Instead of drawing a random number for every packet to decide
+   whether it is lost (or corrupted), the number of packets until the
+   next such event is drawn from a geometric distribution.  Each packet
+   then only costs a counter decrement, and the resulting sequence of
+   events has exactly the same distribution as independent Bernoulli
+   trials with probability p.
+**********************************************************************/
+
+#define SAMPLE_BERNOULLI 0    /* one random draw per packet (original) */
+#define SAMPLE_GEOMETRIC 1    /* skip-ahead to the next event */
+
+struct skipper {
+  double p;          /* per-packet event probability */
+  long countdown;    /* packets still to pass before the next event */
+};
+
+extern void skip_init(struct skipper *s, double p, double (*rng)(void));
+extern long skip_gap(double p, double (*rng)(void));
+
+/* does the event happen to this packet */
+static inline int skip_next(struct skipper *s, double (*rng)(void))
+{
+  if (s->countdown > 0) {
+    s->countdown--;
+    return 0;
+  }
+  s->countdown = skip_gap(s->p, rng);
+  return s->p > 0.0;
+}
+
+/* compare Bernoulli and geometric sampling, returns 0 if they agree */
+extern int sampling_selftest(double (*rng)(void));
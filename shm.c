@@ -0,0 +1,399 @@
+/* ******************************************************************
+   SHARED MEMORY TRANSPORT: A and B in two processes.
+
+   Runs the same protocol code as the emulator (it provides the same
+   student-callable routines), with A in this process and B in a child
+   forked from it.  They share one memory segment holding two
+   single-producer single-consumer rings of packets, one per direction:
+   - tolayer3() packs the packet into the next slot of the sender's
+     ring and publishes it; the other process polls its ring and hands
+     each packet to A_input() or B_input().  A full ring drops the
+     packet, like a full interface queue
+   - timers are deadlines on the monotonic clock, checked every time
+     round the polling loop
+   - messages arrive from layer 5 at A at gaps uniform on
+     [0, 2*lambda], or as fast as the send window takes them
+
+   The rings (spsc.h) take no locks and make no system calls.
+
+   Time is real time since the start of the run, in units of --unit
+   microseconds (1000 by default).  The loss and corruption
+   probabilities (and direction) are applied by the sender before a
+   packet enters the ring.  An idle process yields the CPU unless
+   --spin is given.  What is not about the rings is shared with the
+   other transports, in transport.c.
+
+   Linux only: a shared anonymous mapping and fork().
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
+#include "wire.h"
+#include "spsc.h"
+#include "transport.h"
+
+#define BATCH    64        /* packets taken off the ring at a time */
+#define IDLE_NS  5000000000ULL   /* a run with nothing happening for this long ends */
+#define CACHELINE SPSC_CACHELINE
+
+/* what B hands back to A for the report */
+struct bstats {
+  int packets_received;
+  int nacks_sent;
+  int rcvbuf_released;
+  double rcvbuf_delay;
+  int recoveries;
+  double recoverysum;
+  int held_max;
+  int fec_recovered;
+  long long packets_sent, packets_lost, packets_corrupt, ringfull;
+  long long bytes_delivered;
+  int packets_timeout;
+};
+
+/* the shared segment */
+struct shared {
+  atomic_int delivered;          /* messages B handed to layer 5 */
+  atomic_int stop;               /* A has seen everything delivered */
+  struct bstats b;
+  size_t ringoff[2];             /* offsets of the rings: packets sent by A, by B */
+  size_t stampoff;               /* offset of the message time stamps */
+};
+
+/* parameters, besides transport.h's */
+static int spin = 0;              /* never yield the CPU */
+static unsigned ringsize = 256;   /* slots per ring, a power of two */
+
+/* the segment, as this process sees it */
+static struct shared *sh;
+static struct spsc *ring[2];      /* packets sent by A, by B */
+static int side;                  /* A or B: the process we are */
+
+/* this process's timers */
+static unsigned long long timerat[2], paceat[2];   /* deadlines, 0 for none */
+static struct pacer *pacing[2];
+
+/* the run, as A or B sees it */
+static unsigned long long nextarrival;
+static long long ringfull = 0, polls = 0, yields = 0;
+
+/* map the segment and lay it out */
+static void setup(void)
+{
+  size_t ringbytes, off, size;
+  void *p;
+
+  ringbytes = (spsc_bytes(ringsize, sizeof(int) + wire_size()) + CACHELINE - 1) / CACHELINE * CACHELINE;
+  off = (sizeof(struct shared) + CACHELINE - 1) / CACHELINE * CACHELINE;
+  size = off + 2 * ringbytes + (size_t)(nsimmax + 1) * sizeof(unsigned long long);
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    printf("mapping %lu bytes of shared memory failed.", (unsigned long)size);
+    exit(EXIT_FAILURE);
+  }
+  sh = p;                          /* the mapping starts out zeroed */
+  sh->ringoff[A] = off;
+  sh->ringoff[B] = off + ringbytes;
+  sh->stampoff = off + 2 * ringbytes;
+  ring[A] = (struct spsc *)((char *)p + sh->ringoff[A]);
+  ring[B] = (struct spsc *)((char *)p + sh->ringoff[B]);
+  spsc_init(ring[A], ringsize, sizeof(int) + wire_size());
+  spsc_init(ring[B], ringsize, sizeof(int) + wire_size());
+  stamp = (unsigned long long *)((char *)p + sh->stampoff);
+  published = &sh->delivered;
+}
+
+/***************************** THE RINGS *****************************/
+
+/* put a packet sent by AorB into its ring */
+void transmit(int AorB, const struct pkt *packet)
+{
+  char *s;
+
+  if (lost(AorB))
+    return;
+  if ((s = spsc_reserve(ring[AorB])) == NULL) {
+    ringfull++;
+    if (TRACE>0)
+      printf("          TOLAYER3: ring full, packet dropped\n");
+    return;
+  }
+  *(int *)s = wire_pack(s + sizeof(int), packet);
+  corrupt(AorB, s + sizeof(int));
+  spsc_publish(ring[AorB]);
+}
+
+/* hand the packets waiting for us to the protocol, at most BATCH;
+   returns how many there were */
+static int receive(void)
+{
+  struct spsc *r = ring[(side + 1) % 2];
+  unsigned n, i;
+  char *s;
+
+  n = spsc_ready(r, BATCH);
+  for (i = 0; i < n; i++) {
+    s = spsc_slot(r, i);
+    input(side, s + sizeof(int), *(int *)s);
+  }
+  if (n > 0)
+    spsc_release(r, n);
+  return n;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void stoptimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n", get_sim_time());
+  if (timerat[AorB] == 0) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  timerat[AorB] = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n", get_sim_time());
+  if (timerat[AorB] != 0) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  timerat[AorB] = now() + units_to_ns(increment) + 1;
+}
+
+void startpacetimer(int AorB, double increment, struct pacer *pacer)
+{
+  pacing[AorB] = pacer;
+  paceat[AorB] = now() + units_to_ns(increment) + 1;
+}
+
+/************************** LAYER 5 **************************/
+
+/* the messages due from layer 5 by t */
+static int arrivals(unsigned long long t)
+{
+  int n = 0;
+
+  if (saturate)
+    while (nsim < nsimmax && offer())
+      n++;
+  else
+    while (nsim < nsimmax && nextarrival <= t) {
+      offer();
+      nextarrival += interarrival();
+      n++;
+    }
+  return n;
+}
+
+/************************** THE POLLING LOOP **************************/
+
+/* run the timers of this side that are due by t, returns how many */
+static int timers(unsigned long long t)
+{
+  int n = 0;
+
+  if (timerat[side] != 0 && timerat[side] <= t) {
+    timerat[side] = 0;
+    packets_timeout++;
+    if (side == A)
+      proto->A_timerinterrupt();
+    else
+      proto->B_timerinterrupt();
+    n++;
+  }
+  if (paceat[side] != 0 && paceat[side] <= t) {
+    paceat[side] = 0;
+    pace_release(pacing[side], side);
+    n++;
+  }
+  return n;
+}
+
+/* A's loop: until B has delivered every message A accepted */
+static void runA(void)
+{
+  unsigned long long t, last;
+  int work, seen = 0, d;
+
+  proto->A_init();
+  t = last = now();
+  nextarrival = t + interarrival();
+  for (;;) {
+    polls++;
+    work = receive();
+    t = now();
+    work += timers(t);
+    work += arrivals(t);
+    d = atomic_load_explicit(&sh->delivered, memory_order_acquire);
+    if (nsim == nsimmax && d >= accepted)
+      break;
+    if (work > 0 || d != seen) {
+      seen = d;
+      last = t;
+    }
+    else if (t - last > IDLE_NS) {
+      printf("nothing happened for %llu ms, giving up\n", IDLE_NS / 1000000);
+      break;
+    }
+    else if (!spin) {
+      yields++;
+      sched_yield();
+    }
+  }
+  atomic_store_explicit(&sh->stop, 1, memory_order_release);
+}
+
+/* B's loop: until A says stop */
+static void runB(void)
+{
+  unsigned long long t;
+  int work;
+
+  proto->B_init();
+  while (!atomic_load_explicit(&sh->stop, memory_order_acquire)) {
+    polls++;
+    work = receive();
+    t = now();
+    work += timers(t);
+    if (work == 0 && !spin) {
+      yields++;
+      sched_yield();
+    }
+  }
+
+  /* hand A what only B counted */
+  sh->b.packets_received = packets_received;
+  sh->b.nacks_sent = nacks_sent;
+  sh->b.rcvbuf_released = rcvbuf_released;
+  sh->b.rcvbuf_delay = rcvbuf_delay;
+  sh->b.recoveries = recoveries;
+  sh->b.recoverysum = recoverysum;
+  sh->b.held_max = held_max;
+  sh->b.fec_recovered = fec_recovered;
+  sh->b.packets_sent = packets_sent;
+  sh->b.packets_lost = packets_lost;
+  sh->b.packets_corrupt = packets_corrupt;
+  sh->b.ringfull = ringfull;
+  sh->b.bytes_delivered = bytes_delivered;
+  sh->b.packets_timeout = packets_timeout;
+}
+
+/************************** REPORT **************************/
+
+static double cpuseconds(const struct rusage *ru)
+{
+  return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void report(void)
+{
+  double wall = (now() - start) / 1e9;
+  double cpua, cpub;
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  cpua = cpuseconds(&ru);
+  getrusage(RUSAGE_CHILDREN, &ru);
+  cpub = cpuseconds(&ru);
+
+  /* B's side of the statistics */
+  packets_received = sh->b.packets_received;
+  nacks_sent = sh->b.nacks_sent;
+  fec_recovered = sh->b.fec_recovered;
+  messages_delivered = atomic_load(&sh->delivered);
+  bytes_delivered = sh->b.bytes_delivered;
+  rcvbuf_released = sh->b.rcvbuf_released;
+  rcvbuf_delay = sh->b.rcvbuf_delay;
+  recoveries = sh->b.recoveries;
+  recoverysum = sh->b.recoverysum;
+  held_max = sh->b.held_max;
+
+  transport_report("Shared memory", wall);
+  printf("packets sent by A:  %lld, lost %lld, corrupted %lld, dropped on a full ring %lld \n",
+         packets_sent, packets_lost, packets_corrupt, ringfull);
+  printf("packets sent by B:  %lld, lost %lld, corrupted %lld, dropped on a full ring %lld \n",
+         sh->b.packets_sent, sh->b.packets_lost, sh->b.packets_corrupt, sh->b.ringfull);
+  printf("packets per second:  %f \n", wall > 0.0 ? (packets_sent + sh->b.packets_sent) / wall : 0.0);
+  printf("timer interrupts:  %d at A, %d at B \n", packets_timeout, sh->b.packets_timeout);
+  printf("CPU time:  %f s for A, %f s for B, %f us per message delivered \n", cpua, cpub,
+         messages_delivered > 0 ? (cpua + cpub) * 1e6 / messages_delivered : 0.0);
+}
+
+/* command line options, given before the interactive parameters */
+static void parseargs(int argc, char *argv[])
+{
+  int i;
+  const char *v;
+
+  for (i = 1; i < argc; i++) {
+    if ((v = optval(argv[i], "--ring")) != NULL) {
+      ringsize = atoi(v);
+      if (ringsize < 2 || (ringsize & (ringsize - 1)) != 0) {
+        printf("bad ring size (a power of two): %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "--spin") == 0)
+      spin = 1;
+    else if (!transport_option(argv[i])) {
+      printf("unknown option: %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  pid_t child;
+  int status;
+
+  checksum_init();
+  parseargs(argc, argv);
+  proto = protocol_of(0);
+  readparams("Shared Memory Transport");
+  setup();
+  start = now();
+  if (TRACE > 0)                  /* the two processes' lines interleave */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+  fflush(stdout);                 /* or the child prints it again */
+  if ((child = fork()) < 0) {
+    printf("fork failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (child == 0) {
+    side = B;
+    transport_seed(10000);
+    runB();
+    exit(EXIT_SUCCESS);
+  }
+  side = A;
+  transport_seed(9999);
+  runA();
+  if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    printf("B's process failed\n");
+    exit(EXIT_FAILURE);
+  }
+  report();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/* ******************************************************************
+   The emulator as a library.
+
+   A program links the emulator's files (all of the emulator's build
+   line but main.c, the command-line front end) and drives runs itself:
+
+     struct sim *s = sim_create();
+     sim_option(s, "--flows=4");      options, as on the command line
+     sim_params(s, &params);          what the front end prompts for
+     sim_on_delivery(s, fn, arg);     callbacks, optional
+     sim_run_until(s, 500.0, 0);      or sim_step(), or sim_run()
+     sim_stats(s, &stats);            at any point between steps
+     sim_destroy(s);
+
+   The emulator keeps its state in globals, so a process has one
+   simulation at a time; sim_create() returns NULL while one exists.
+   The handle names that simulation, not state of its own: every call
+   checks it and exits if it is not the live one, as after
+   sim_destroy().
+   sim_destroy() frees the flows and puts every option back to its
+   default, so each simulation starts from the defaults whatever the
+   ones before it used.  The parameters are per run.
+   Errors are reported as the front end reports them, with a message
+   on stdout and exit().
+
+   A checkpoint (--checkpoint-time or --checkpoint-msgs) forks the
+   process inside sim_step(), sim_run_until() or sim_run(), once per
+   --branch.  Each child returns from that call into the program with
+   its branch applied, so the program's code after it runs once per
+   branch, in the child, and then once more for the baseline: the
+   parent waits until each child has exited before it goes on.  A
+   program that does more than finish the run and report should end a
+   child once its branch is done, e.g. with exit() when sim_branch()
+   is not 0.
+**********************************************************************/
+
+/* the event types, as passed to the event callback */
+#define SIM_TIMER_INTERRUPT 0
+#define SIM_FROM_LAYER5     1
+#define SIM_FROM_LAYER3     2
+#define SIM_PACE_RELEASE    3
+#define SIM_FROM_HOP        4   /* packet reaches a router on the path */
+
+/* the parameters the front end prompts for */
+struct sim_params {
+  int nsimmax;              /* messages to simulate, per flow */
+  float lossprob;           /* probability that a packet is dropped */
+  float corruptprob;        /* probability that a packet is corrupted */
+  int corruptdirection;     /* where loss and corruption happen: 0 A->B, 1 A<-B, 2 both */
+  float lambda;             /* average time between messages from layer 5 */
+  int trace;                /* TRACE level, 0 for a silent run */
+  unsigned int seed;        /* random seed, 9999 for the front end's */
+};
+
+/* the run's statistics so far, as in the report */
+struct sim_stats {
+  double time;              /* simulated time reached */
+  int nsim;                 /* messages from layer 5 */
+  int window_full;          /* of those, dropped due to full window */
+  int new_ACKs;             /* valid acknowledgements received at A */
+  int packets_resent;       /* packet resends by A */
+  int packets_received;     /* correct packets received at B */
+  int messages_delivered;   /* messages delivered to layer 5 */
+  long long bytes_delivered;
+  int packets_timeout;      /* timer interrupts */
+  int packets_sent;         /* packets into layer 3 */
+  int packets_lost;         /* of those, lost */
+  int packets_corrupt;      /* of those, corrupted */
+  int packets_reordered;    /* of those, held back for later ones to overtake */
+  int packets_duplicated;   /* of those, delivered twice */
+  double goodput;           /* bytes per time unit, up to the last delivery */
+  double latency;           /* average message latency, after --warmup */
+  const char *stopped;      /* the stop condition that ended the run, or NULL */
+};
+
+/* one flow's share of them */
+struct sim_flowstats {
+  int nsim;
+  int delivered;
+  long long bytes;
+  double latency;           /* average message latency */
+  int resent;
+  int dropped;
+};
+
+struct sim;
+
+/* a message reached layer 5 for flow at time; latency is the time
+   since layer 5 handed it to A, or negative if it could not be matched
+   to one */
+typedef void sim_delivery_fn(void *arg, int flow, double time, int bytes, double latency);
+
+/* the emulator is about to handle an event of type (SIM_*) for entity
+   A or B of flow, at time */
+typedef void sim_event_fn(void *arg, double time, int type, int entity, int flow);
+
+/* a new simulation, or NULL while another one exists */
+extern struct sim *sim_create(void);
+
+/* apply a command-line option ("--flows=4"), before the parameters are
+   given.  Returns 0 if there is no such option */
+extern int sim_option(struct sim *, const char *option);
+
+/* set the parameters.  Given again between steps, they change the run
+   in progress, as a checkpoint branch does */
+extern void sim_params(struct sim *, const struct sim_params *);
+
+/* prompt for the parameters on stdin, as the emulator always did */
+extern void sim_readparams(struct sim *);
+
+/* callbacks, NULL for none.  With --threads they are called from the
+   thread that runs the flow */
+extern void sim_on_delivery(struct sim *, sim_delivery_fn *, void *arg);
+extern void sim_on_event(struct sim *, sim_event_fn *, void *arg);
+
+/* handle the next event.  Returns 0 if there is none, or a stop
+   condition ends the run.  Not with --threads or --replicate */
+extern int sim_step(struct sim *);
+
+/* handle the events before time until (< 0 for no limit), at most
+   maxevents of them (0 for no limit).  Returns the number handled.
+   Not with --threads or --replicate */
+extern long sim_run_until(struct sim *, double until, long maxevents);
+
+/* run to the end, in the way the options ask for: on --threads
+   threads, as --replicate replications (which print their summary),
+   or on this one */
+extern void sim_run(struct sim *);
+
+extern void sim_stats(const struct sim *, struct sim_stats *);
+extern void sim_flowstats(const struct sim *, int flow, struct sim_flowstats *);
+
+/* the checkpoint branch this process runs: 0 for the baseline (and
+   without a checkpoint), i for the child running --branch number i */
+extern int sim_branch(const struct sim *);
+
+/* print the emulator's report of the run; nothing after --replicate,
+   whose replications print their own */
+extern void sim_report(const struct sim *);
+
+extern void sim_destroy(struct sim *);
@@ -0,0 +1,94 @@
+/* ******************************************************************
+   Lock-free single-producer single-consumer ring of fixed-size slots,
+   for the transports that run A and B at the same time (shm.c, rt.c).
+
+   The producer fills the slot at tail, then releases tail + 1; the
+   consumer acquires tail, reads the slots up to it, then releases the
+   new head.  Each index sits on a cache line of its own, next to its
+   owner's private copy of the other index, which is only refreshed
+   when the copy says the ring is full (for the producer) or empty
+   (for the consumer).  The ring holds no pointers, so it can live in
+   memory shared between processes.
+**********************************************************************/
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SPSC_CACHELINE 64
+
+struct spsc {
+  _Alignas(SPSC_CACHELINE) atomic_uint tail;   /* slots filled, ever */
+  unsigned headcopy;                           /* the producer's copy of head */
+  _Alignas(SPSC_CACHELINE) atomic_uint head;   /* slots emptied, ever */
+  unsigned tailcopy;                           /* the consumer's copy of tail */
+  _Alignas(SPSC_CACHELINE) unsigned size;      /* slots, a power of two */
+  unsigned slotsize;                           /* bytes per slot, whole cache lines */
+  _Alignas(SPSC_CACHELINE) char slot[];
+};
+
+/* bytes taken by a ring of size slots of at least bytes each */
+static inline size_t spsc_bytes(unsigned size, size_t bytes)
+{
+  size_t slotsize = (bytes + SPSC_CACHELINE - 1) / SPSC_CACHELINE * SPSC_CACHELINE;
+
+  return sizeof(struct spsc) + (size_t)size * slotsize;
+}
+
+/* set up an empty ring in memory of spsc_bytes(size, bytes), suitably aligned */
+static inline void spsc_init(struct spsc *r, unsigned size, size_t bytes)
+{
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->head, 0);
+  r->headcopy = r->tailcopy = 0;
+  r->size = size;
+  r->slotsize = (bytes + SPSC_CACHELINE - 1) / SPSC_CACHELINE * SPSC_CACHELINE;
+}
+
+/* producer: the slot to fill next, or NULL if the ring is full */
+static inline char *spsc_reserve(struct spsc *r)
+{
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (tail - r->headcopy == r->size) {
+    r->headcopy = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - r->headcopy == r->size)
+      return NULL;
+  }
+  return r->slot + (size_t)(tail & (r->size - 1)) * r->slotsize;
+}
+
+/* producer: hand the reserved slot to the consumer */
+static inline void spsc_publish(struct spsc *r)
+{
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* consumer: the number of filled slots, at most max */
+static inline unsigned spsc_ready(struct spsc *r, unsigned max)
+{
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned n;
+
+  if (r->tailcopy == head)
+    r->tailcopy = atomic_load_explicit(&r->tail, memory_order_acquire);
+  n = r->tailcopy - head;
+  return n < max ? n : max;
+}
+
+/* consumer: filled slot i, counting from the oldest */
+static inline char *spsc_slot(struct spsc *r, unsigned i)
+{
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  return r->slot + (size_t)((head + i) & (r->size - 1)) * r->slotsize;
+}
+
+/* consumer: give the n oldest slots back to the producer */
+static inline void spsc_release(struct spsc *r, unsigned n)
+{
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
@@ -1,8 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "sr.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -27,29 +33,24 @@
                           MUST BE SET TO 6 when submitting assignment */
 #define SEQSPACE 12      /* the min sequence space for GBN must be at least windowsize + 1 */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define NACK (-2)       /* seqnum of a negative acknowledgement: resend acknum */
+#define NACKHOLDOFF (RTT / 2)  /* least time between two NACKs for the same packet */
 /*#define MAX_WINDOWFULL 1000*/ /*autograder doesnt want this buffer :( )*/
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
+   The engine (additive sum or CRC-32C) is chosen with --checksum.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
+  return pkt_checksum(packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
@@ -58,58 +59,105 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[SEQSPACE];  /* array for storing packets waiting for ACK */
-static struct pkt bufferB [SEQSPACE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static float timers[SEQSPACE];         /* array of timers for each packet */
-static int isAcked[SEQSPACE];          /*track whether packet has been acked*/
-static bool recieved[SEQSPACE];         /*track whether packet has been received*/
-static int unacked_min;                 /* the minimum sequence number of unacked packets */
-/*static struct msg window_overflow[MAX_WINDOWFULL]; */ /*arra for dropped packets due to full window*/
-/*static int window_overflow_front; *//* index of the first packet in the window overflow buffer*/
-/*static int window_overflow_rear; *//* index of the last packet in the window overflow buffer*/
-static int sent_packets; /* number of packets sent*/
-/*static int universalTimer; /* universal timer for all packets*/
+struct sender {
+  struct pkt buffer[SEQSPACE];  /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+  float timers[SEQSPACE];         /* array of timers for each packet */
+  int isAcked[SEQSPACE];          /*track whether packet has been acked*/
+  int unacked_min;                 /* the minimum sequence number of unacked packets */
+  /*struct msg window_overflow[MAX_WINDOWFULL]; */ /*arra for dropped packets due to full window*/
+  /*int window_overflow_front; *//* index of the first packet in the window overflow buffer*/
+  /*int window_overflow_rear; *//* index of the last packet in the window overflow buffer*/
+  int sent_packets; /* number of packets sent*/
+  /*int universalTimer; /* universal timer for all packets*/
+  struct pbuf *segbuf;            /* message still being cut into segments, or NULL */
+  int segoffset, seglen;          /* next offset to send and size of that message */
+  struct fecsender A_fec;         /* parity of the packets sent so far, with --fec */
+  struct pacer A_pace;            /* token bucket, with --pace */
+};
+
+/* A's state, one per flow (see protocol_flows()); snd is the flow the
+   emulator is calling for on this thread */
+static struct sender sender0;
+static struct sender *senders = &sender0;
+static __thread struct sender *snd = &sender0;
+
+#define WINDOWOPEN() (((snd->A_nextseqnum - snd->windowfirst + SEQSPACE) % SEQSPACE) < WINDOWSIZE)
+
+/* number, checksum, buffer and send a packet whose payload is filled in */
+static void A_send(struct pkt *sendpkt)
+{
+  sendpkt->seqnum = snd->A_nextseqnum;
+  sendpkt->acknum = NOTINUSE;
+  if (fec_k > 0)
+    fec_number(&snd->A_fec, sendpkt);
+  sendpkt->checksum = ComputeChecksum(sendpkt);
+
+  snd->buffer[sendpkt->seqnum] = *sendpkt; /* store packet in buffer*/
+  snd->isAcked[sendpkt->seqnum] = 0; /*mark packet as not acked*/
+  snd->timers[sendpkt->seqnum] = RTT;
+
+  /* get next sequence number, wrap back to 0 */
 
+  snd->A_nextseqnum = (snd->A_nextseqnum + 1) % SEQSPACE;
+
+
+
+  /* send out packet */
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  pace_send(&snd->A_pace, A, sendpkt, 1);
+  if (fec_k > 0)
+    fec_sent(&snd->A_fec, sendpkt);
+  snd->sent_packets++;
+  if(snd->windowfirst == sendpkt->seqnum) { /*start timer if first packet in window*/
+    starttimer(A,RTT);
+    /*universalTimer = RTT; /*signify timer on*/
+  };
+}
+
+/* send as many segments of the current large message as the window allows */
+static void A_sendsegments(void)
+{
+  struct pkt sendpkt;
+
+  while (snd->segbuf != NULL && WINDOWOPEN()) {
+    snd->segoffset += pkt_segment(&sendpkt, snd->segbuf, snd->segoffset, snd->seglen);
+    A_send(&sendpkt);
+    if (snd->segoffset == snd->seglen) {
+      pbuf_unref(snd->segbuf);
+      snd->segbuf = NULL;
+    }
+  }
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output_ref(const struct msg *message)
 {
   struct pkt sendpkt;
   int i;
 
-  if (((A_nextseqnum - windowfirst + SEQSPACE) % SEQSPACE) < WINDOWSIZE){
+  if (WINDOWOPEN() && snd->segbuf == NULL){
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+
+    if (message->buf != NULL) {
+      /* large message: segments refer to its buffer, they do not copy it */
+      snd->segbuf = pbuf_ref(message->buf);
+      snd->segoffset = 0;
+      snd->seglen = message->length;
+      A_sendsegments();
+      return;
+    }
      
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ )
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    buffer[sendpkt.seqnum] = sendpkt; /* store packet in buffer*/
-    isAcked[sendpkt.seqnum] = 0; /*mark packet as not acked*/
-    timers[sendpkt.seqnum] = RTT;
-
-    /* get next sequence number, wrap back to 0 */
-
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
-
-
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-    sent_packets++;
-    if(sent_packets == 1) { /*start timer if first packet in window*/
-      starttimer(A,RTT);
-      /*universalTimer = RTT; /*signify timer on*/
-    };
+      sendpkt.payload[i] = message->data[i];
+    sendpkt.length = sendpkt.offset = sendpkt.msglen = 0;
+    sendpkt.buf = NULL;
+    A_send(&sendpkt);
   
     /*if (windowfirst == A_nextseqnum) { */ /*start timer if first packet in window*/
      /* starttimer(A,RTT);
@@ -127,36 +175,58 @@ void A_output(struct msg message)
 }
 
 
+/* B reports packet n missing: resend it now rather than at the next timeout */
+static void A_nack(int n)
+{
+  if (((n - snd->windowfirst + SEQSPACE) % SEQSPACE) < (snd->A_nextseqnum - snd->windowfirst + SEQSPACE) % SEQSPACE
+      && !snd->isAcked[n]) {
+    if (TRACE > 0)
+      printf ("----A: NACK %d is received, resending packet %d\n", n, n);
+    pace_send(&snd->A_pace, A, &snd->buffer[n], 1);
+    packets_resent++;
+    packets_resent_nack++;
+    snd->timers[n] = RTT;
+  }
+  else
+    if (TRACE > 0)
+      printf ("----A: NACK %d is not for an unacked packet, do nothing!\n", n);
+}
+
 /* called from layer 3, when a packet arrives for layer 4
-   In this practical this will always be an ACK as B never sends data.
+   In this practical this will always be an ACK (or, with --nack, a NACK)
+   as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input_ref(const struct pkt *packet)
 {
   /*struct msg next_msg;*/
 
   /* if received ACK is not corrupted */
   if (!IsCorrupted(packet)) {
+    if (packet->seqnum == NACK) {
+      A_nack(packet->acknum);
+      return;
+    }
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
     /*check in window*/
-    if(((packet.acknum - windowfirst + SEQSPACE) % SEQSPACE) < (A_nextseqnum - windowfirst + SEQSPACE) % SEQSPACE){
+    if(((packet->acknum - snd->windowfirst + SEQSPACE) % SEQSPACE) < (snd->A_nextseqnum - snd->windowfirst + SEQSPACE) % SEQSPACE){
       /* check if new ACK or duplicate */
-      if (!isAcked[packet.acknum]) {
-          isAcked[packet.acknum] = 1; /*mark packet as acked*/
+      if (!snd->isAcked[packet->acknum]) {
+          snd->isAcked[packet->acknum] = 1; /*mark packet as acked*/
           new_ACKs++;
-          if (packet.acknum == unacked_min){
-            unacked_min = (unacked_min + 1) % SEQSPACE;
+          if (packet->acknum == snd->unacked_min){
+            snd->unacked_min = (snd->unacked_min + 1) % SEQSPACE;
           }
 
           if (TRACE > 0)
-            printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+            printf("----A: ACK %d is not a duplicate\n",packet->acknum);
 
-          while ((windowfirst != A_nextseqnum) && isAcked[windowfirst]) {
-            timers[windowfirst] = NOTINUSE;
-            recieved[windowfirst] = 0;
-            windowfirst = (windowfirst + 1) % SEQSPACE;
+          while ((snd->windowfirst != snd->A_nextseqnum) && snd->isAcked[snd->windowfirst]) {
+            pkt_release(&snd->buffer[snd->windowfirst]);
+            snd->timers[snd->windowfirst] = NOTINUSE;
+            snd->windowfirst = (snd->windowfirst + 1) % SEQSPACE;
             /*if (window_overflow_front != window_overflow_rear) {
               next_msg = window_overflow[window_overflow_front];
               window_overflow_front = (window_overflow_front + 1) % MAX_WINDOWFULL;
@@ -164,13 +234,15 @@ void A_input(struct pkt packet)
           }*/
           }
 
-          /*if (windowfirst == A_nextseqnum){*/
-          if(packet.acknum <= unacked_min ||total_ACKs_received == sent_packets){
-            stoptimer(A);
-            /*universalTimer = NOTINUSE; /*start universal timer off*/
-            if(total_ACKs_received != sent_packets ){
-              starttimer(A, RTT);
-              /*universalTimer = RTT; /*signify timer on*/}}
+          /* restart the timer while packets are still awaiting an ACK */
+          stoptimer(A);
+          /*universalTimer = NOTINUSE; /*start universal timer off*/
+          if (snd->windowfirst != snd->A_nextseqnum) {
+            starttimer(A, RTT);
+            /*universalTimer = RTT; /*signify timer on*/}
+
+          /* the window has room again for the rest of a large message */
+          A_sendsegments();
         }
         else
           if (TRACE > 0)
@@ -182,7 +254,7 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void)
 {
   int i;
 
@@ -190,14 +262,14 @@ void A_timerinterrupt(void)
     printf("----A: time out,resend packets!\n");
 
   for(i=0; i<SEQSPACE; i++) {
-    if(isAcked[i] == 0 && timers[i] != NOTINUSE){
-      timers[i] -= RTT;
-      if (timers[i] <= 0) {
+    if(snd->isAcked[i] == 0 && snd->timers[i] != NOTINUSE){
+      snd->timers[i] -= RTT;
+      if (snd->timers[i] <= 0) {
         if (TRACE > 0)
-          printf ("---A: resending packet %d\n", buffer[i].seqnum);
-        tolayer3(A, buffer[i]);
+          printf ("---A: resending packet %d\n", snd->buffer[i].seqnum);
+        pace_send(&snd->A_pace, A, &snd->buffer[i], 1);
         packets_resent++;
-        timers[i] = RTT;
+        snd->timers[i] = RTT;
         starttimer(A, RTT);
         break;
       }
@@ -208,22 +280,26 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void)
 { int i;
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
+  snd->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  snd->windowfirst = 0;
+  snd->windowlast = -1;   /* windowlast is where the last packet sent is stored.
 		     new packets are placed in winlast + 1
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
-  unacked_min = 0;
+  snd->windowcount = 0;
+  snd->unacked_min = 0;
+  snd->segbuf = NULL;
+  if (fec_k > 0)
+    fec_sender_init(&snd->A_fec, &snd->A_pace);
+  pace_init(&snd->A_pace, WINDOWSIZE / RTT);
   total_ACKs_received = 0;
   new_ACKs = 0;
       for (i = 0; i < SEQSPACE; i++) {
-        isAcked[i] = 1;         /*start things acked*/
-        timers[i] = NOTINUSE;    /*start timers off*/
+        snd->isAcked[i] = 1;         /*start things acked*/
+        snd->timers[i] = NOTINUSE;    /*start timers off*/
         /*universalTimer = NOTINUSE; /*start universal timer off*/
     }
     /*window_overflow_rear =0;
@@ -232,38 +308,150 @@ void A_init(void)
 
 /********* Receiver (B)  variables and procedures ************/
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+struct receiver {
+  struct pkt bufferB[SEQSPACE];   /* packets received ahead of B_expectedseqnum */
+  bool recieved[SEQSPACE];        /* track whether bufferB holds a packet */
+  double arrivedB[SEQSPACE];      /* time each buffered packet arrived */
+  int B_expectedseqnum;           /* first sequence number of B's receive window */
+  int B_held;                     /* number of packets in bufferB */
+  double missingB[SEQSPACE];      /* time B found a packet missing, or NOTINUSE */
+  double nackedB[SEQSPACE];       /* time of the last NACK for a packet, or NOTINUSE */
+  struct reassembly B_reasm;      /* segments of the message being received */
+  struct fecreceiver *B_fec;      /* packets kept to rebuild losses, with --fec */
+};
+
+static struct receiver receiver0;
+static struct receiver *receivers = &receiver0;
+static __thread struct receiver *rcv = &receiver0;
+static int ncopies = 1;       /* flows in senders and receivers */
+
+/* send an acknowledgement (seqnum NOTINUSE) or a NACK (seqnum NACK) for acknum */
+static void B_send(int seqnum, int acknum)
 {
   struct pkt sendpkt;
   int i;
 
-  /* if not corrupted and received packet is in order */
-  if  (!IsCorrupted(packet)) {
-    if((((packet.seqnum - windowfirst + SEQSPACE) % SEQSPACE) < WINDOWSIZE)) {
-      bufferB[packet.seqnum] = packet;
-      if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-      packets_received++;
-      if(!recieved[packet.seqnum]){
-      /* deliver to receiving application */
-      tolayer5(B, packet.payload);}
-      recieved[packet.seqnum] = 1;
-
-    }
-      /* create packet */
-  sendpkt.seqnum = NOTINUSE;
-  sendpkt.acknum = packet.seqnum;
+  /* create packet */
+  sendpkt.seqnum = seqnum;
+  sendpkt.acknum = acknum;
 
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ )
     sendpkt.payload[i] = '0';
 
+  sendpkt.length = sendpkt.offset = sendpkt.msglen = 0;
+  sendpkt.buf = NULL;
+
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt);
+  sendpkt.checksum = ComputeChecksum(&sendpkt);
 
   /* send out packet */
-  tolayer3 (B, sendpkt);
+  tolayer3_ref (B, &sendpkt);
+}
+
+/* the packets between B_expectedseqnum and seq have not arrived: note when
+   they went missing and, in NACK mode, ask A for them again, at most once
+   every NACKHOLDOFF per packet.  Nothing is missing below a seq that has
+   just filled the gap, and B_expectedseqnum is already past it */
+static void B_gap(int seq)
+{
+  double now = get_sim_time();
+  int n;
+
+  if ((seq - rcv->B_expectedseqnum + SEQSPACE) % SEQSPACE >= WINDOWSIZE)
+    return;
+  for (n = rcv->B_expectedseqnum; n != seq; n = (n + 1) % SEQSPACE) {
+    if (rcv->recieved[n])
+      continue;
+    if (rcv->missingB[n] == NOTINUSE)
+      rcv->missingB[n] = now;
+    if (nack && (rcv->nackedB[n] == NOTINUSE || now - rcv->nackedB[n] >= NACKHOLDOFF)) {
+      if (TRACE > 0)
+        printf("----B: packet %d is missing, send NACK!\n", n);
+      rcv->nackedB[n] = now;
+      nacks_sent++;
+      B_send(NACK, n);
+    }
+  }
+}
+
+/* an uncorrupted data packet arrived (or was rebuilt by FEC) */
+static void B_receive(const struct pkt *packet)
+{
+  int seq;
+
+  seq = packet->seqnum;
+  /* in B's receive window: keep it, then release what is now in order */
+  if((((seq - rcv->B_expectedseqnum + SEQSPACE) % SEQSPACE) < WINDOWSIZE)) {
+    if (TRACE > 0)
+    printf("----B: packet %d is correctly received, send ACK!\n",seq);
+    packets_received++;
+    if(!rcv->recieved[seq]){
+      rcv->bufferB[seq] = *packet;
+      if (packet->buf != NULL)
+        pbuf_ref(packet->buf);
+      rcv->recieved[seq] = 1;
+      rcv->arrivedB[seq] = get_sim_time();
+      rcv->B_held++;
+      if (rcv->missingB[seq] != NOTINUSE) {
+        loss_recovered(rcv->missingB[seq]);
+        rcv->missingB[seq] = NOTINUSE;
+      }
+      rcv->nackedB[seq] = NOTINUSE;
+      if (seq != rcv->B_expectedseqnum && TRACE > 0)
+        printf("----B: packet %d held until %d arrives\n", seq, rcv->B_expectedseqnum);
+
+      /* deliver the contiguous run to the receiving application in order
+         (once complete, for a large message) */
+      while (rcv->recieved[rcv->B_expectedseqnum]) {
+        if (rcv->B_expectedseqnum != seq)
+          rcvbuf_release(rcv->arrivedB[rcv->B_expectedseqnum]);
+        deliver_segment(&rcv->B_reasm, B, &rcv->bufferB[rcv->B_expectedseqnum]);
+        pkt_release(&rcv->bufferB[rcv->B_expectedseqnum]);
+        rcv->recieved[rcv->B_expectedseqnum] = 0;
+        rcv->B_held--;
+        rcv->B_expectedseqnum = (rcv->B_expectedseqnum + 1) % SEQSPACE;
+      }
+      rcvbuf_occupancy(rcv->B_held);
+    }
+    B_send(NOTINUSE, seq);
+    if (rcv->B_held > 0)
+      B_gap(seq);
+    return;
+  }
+  /* packets from the previous window were delivered already, but their
+     ACK may have been lost: ACK them again so A can move on */
+  else if (((rcv->B_expectedseqnum - seq + SEQSPACE) % SEQSPACE) <= WINDOWSIZE) {
+    if (TRACE > 0)
+      printf("----B: packet %d was already delivered, send ACK again!\n", seq);
+  }
+  else {
+    if (TRACE > 0)
+      printf("----B: packet %d is outside the receive window, ignore it\n", seq);
+    return;
+  }
+  B_send(NOTINUSE, seq);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+static void B_input_ref(const struct pkt *packet)
+{
+  struct pkt rebuilt;
+
+  /* if not corrupted */
+  if  (!IsCorrupted(packet)) {
+    if (packet->seqnum == FEC_PARITY) {
+      if (TRACE > 0)
+        printf("----B: parity packet for group %d is received\n", packet->acknum);
+    }
+    else
+      B_receive(packet);
+
+    /* a lost packet FEC can rebuild counts as received */
+    if (fec_k > 0 && fec_input(rcv->B_fec, packet, &rebuilt)) {
+      B_receive(&rebuilt);
+      pkt_release(&rebuilt);
+    }
   }
   /*else {*/
     /* packet is corrupted or out of order resend last ACK */
@@ -273,24 +461,111 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void)
 {
   int i;
   for (i = 0; i < SEQSPACE; i++) {
-      recieved[i] = 0;
+      rcv->recieved[i] = 0;
+      rcv->bufferB[i].buf = NULL;
+      rcv->missingB[i] = NOTINUSE;
+      rcv->nackedB[i] = NOTINUSE;
+  }
+  rcv->B_expectedseqnum = 0;
+  rcv->B_held = 0;
+  rcv->B_reasm.next = 0;
+  rcv->B_reasm.buf = NULL;
+  if (fec_k > 0) {
+    if (rcv->B_fec == NULL)
+      rcv->B_fec = calloc(1, sizeof(struct fecreceiver));
+    if (rcv->B_fec == NULL) {
+      printf("memory allocation for FEC failed.");
+      exit(EXIT_FAILURE);
+    }
+    fec_receiver_init(rcv->B_fec);
+  }
+}
+
+/* the callbacks that follow act for the given flow */
+static void protocol_bind(int flow)
+{
+  snd = &senders[flow];
+  rcv = &receivers[flow];
+}
+
+/* drop the buffers and FEC state the copies of an earlier simulation
+   still hold */
+static void dropflows(void)
+{
+  struct sender *s;
+  struct receiver *r;
+  int i, k;
+
+  for (i = 0; i < ncopies; i++) {
+    s = &senders[i];
+    r = &receivers[i];
+    for (k = 0; k < SEQSPACE; k++)
+      pkt_release(&s->buffer[k]);
+    if (s->segbuf != NULL)
+      pbuf_unref(s->segbuf);
+    free(s->A_fec.acc);
+    if (r->B_reasm.buf != NULL)
+      pbuf_unref(r->B_reasm.buf);
+    if (r->B_fec != NULL) {
+      for (k = 0; k < FEC_RING; k++) {
+        pkt_release(&r->B_fec->data[k]);
+        pkt_release(&r->B_fec->parity[k]);
+      }
+      free(r->B_fec);
+    }
+    for (k = 0; k < SEQSPACE; k++)
+      pkt_release(&r->bufferB[k]);
+    memset(s, 0, sizeof(*s));
+    memset(r, 0, sizeof(*r));
   }
 }
 
+/* n copies of A's and B's state, for a run with n flows */
+static void protocol_flows(int n)
+{
+  dropflows();
+  if (senders != &sender0) {    /* an earlier simulation's */
+    free(senders);
+    free(receivers);
+  }
+  senders = &sender0;
+  receivers = &receiver0;
+  ncopies = 1;
+  if (n <= 1) {
+    protocol_bind(0);
+    return;
+  }
+  senders = calloc(n, sizeof(struct sender));
+  receivers = calloc(n, sizeof(struct receiver));
+  if (senders == NULL || receivers == NULL) {
+    printf("memory allocation for %d flows failed.", n);
+    exit(EXIT_FAILURE);
+  }
+  ncopies = n;
+  protocol_bind(0);
+}
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void)
 {
 }
+
+/* what the emulator and the transports run, see protocol.h */
+const struct protocol sr_protocol = {
+  "sr", A_init, B_init, A_output_ref, A_input_ref, B_input_ref,
+  A_timerinterrupt, B_timerinterrupt, B_output, protocol_flows, protocol_bind,
+  PROTO_SEGMENTS | PROTO_FEC | PROTO_NACK | PROTO_PACE
+};
@@ -1,11 +1,6 @@
-extern void A_init(void);
-extern void B_init(void);
-extern void A_input(struct pkt);
-extern void B_input(struct pkt);
-extern void A_output(struct msg);
-extern void A_timerinterrupt(void);
-
-/* included for extension to bidirectional communication */
-#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
-extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+/* the Selective Repeat protocol of sr.c, and the earlier variant of
+   sr1.c.  Their callbacks are private to them; the emulator reaches
+   them through these descriptors (protocol.h, which must be included
+   first) */
+extern const struct protocol sr_protocol;
+extern const struct protocol sr1_protocol;
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "sr.h"
 
 /* ******************************************************************
@@ -35,7 +36,7 @@
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct pkt packet)
 {
   int checksum = 0;
   int i;
@@ -48,7 +49,7 @@ int ComputeChecksum(struct pkt packet)
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(struct pkt packet)
 {
   if (packet.checksum == ComputeChecksum(packet))
     return (false);
@@ -74,7 +75,7 @@ static int sent_packets; /* number of packets sent*/
 
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output(struct msg message)
 {
   struct pkt sendpkt;
   int i;
@@ -129,7 +130,7 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input(struct pkt packet)
 {
   /*struct msg next_msg;*/
 
@@ -177,7 +178,7 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void)
 {
   int i;
 
@@ -201,7 +202,7 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void)
 { int i;
   /* initialise A's window, buffer and sequence number */
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
@@ -224,7 +225,7 @@ void A_init(void)
 /********* Receiver (B)  variables and procedures ************/
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(struct pkt packet)
 {
   struct pkt sendpkt;
   int i;
@@ -266,7 +267,7 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void)
 {
   int i;
   for (i = 0; i < SEQSPACE; i++) {
@@ -279,11 +280,35 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void)
 {
-}
\ No newline at end of file
+}
+
+/* the emulator hands over views of its messages and packets; this
+   protocol takes its own copies */
+static void A_output_ref(const struct msg *message)
+{
+  A_output(*message);
+}
+
+static void A_input_ref(const struct pkt *packet)
+{
+  A_input(*packet);
+}
+
+static void B_input_ref(const struct pkt *packet)
+{
+  B_input(*packet);
+}
+
+/* what the emulator and the transports run, see protocol.h.  Its state
+   is a single copy in statics, so it runs one flow only */
+const struct protocol sr1_protocol = {
+  "sr1", A_init, B_init, A_output_ref, A_input_ref, B_input_ref,
+  A_timerinterrupt, B_timerinterrupt, B_output, NULL, NULL, 0
+};
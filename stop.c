@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include "stop.h"
+#include "instrument.h"
+
+double stop_time = -1.0;
+long long stop_msgs = 0;
+long long stop_bytes = 0;
+double stop_steady = 0.0;
+double stop_block = 1000.0;
+double stop_budget = 0.0;
+int stop_any = 0;
+
+const char *stop_reason = NULL;
+
+static char reason[128];
+static unsigned long long started;   /* instr_clock() at the start */
+static unsigned long calls;
+static double blockend;              /* end of the current goodput block */
+static long long blockbytes;         /* bytes delivered when it began */
+static double rates[STOP_BLOCKS];    /* goodput of the last blocks */
+static int nblocks;
+
+#define CLOCKEVERY 256               /* calls between looks at the clock */
+
+void stop_reset(void)
+{
+  stop_reason = NULL;
+  started = instr_clock();
+  calls = 0;
+  blockend = stop_block;
+  blockbytes = 0;
+  nblocks = 0;
+}
+
+/* have the last STOP_BLOCKS blocks' goodputs settled */
+static int steady(double *mean)
+{
+  double min, max, sum = 0.0;
+  int i;
+
+  if (nblocks < STOP_BLOCKS)
+    return 0;
+  min = max = rates[0];
+  for (i = 0; i < STOP_BLOCKS; i++) {
+    sum += rates[i];
+    if (rates[i] < min)
+      min = rates[i];
+    if (rates[i] > max)
+      max = rates[i];
+  }
+  *mean = sum / STOP_BLOCKS;
+  return *mean > 0.0 && max - *mean <= stop_steady * *mean && *mean - min <= stop_steady * *mean;
+}
+
+int stop_check(double now, long long msgs, long long bytes)
+{
+  double mean, spent;
+
+  if (stop_time >= 0.0 && now >= stop_time)
+    sprintf(reason, "virtual time horizon %f reached", stop_time);
+  else if (stop_msgs > 0 && msgs >= stop_msgs)
+    sprintf(reason, "%lld messages delivered", msgs);
+  else if (stop_bytes > 0 && bytes >= stop_bytes)
+    sprintf(reason, "%lld bytes delivered", bytes);
+  else {
+    reason[0] = '\0';
+    if (stop_steady > 0.0)
+      while (now >= blockend && reason[0] == '\0') {
+        rates[nblocks++ % STOP_BLOCKS] = (bytes - blockbytes) / stop_block;
+        blockbytes = bytes;
+        blockend += stop_block;
+        if (steady(&mean))
+          sprintf(reason, "goodput steady at %f bytes per time unit over %d blocks of %g",
+                  mean, STOP_BLOCKS, stop_block);
+      }
+    if (reason[0] == '\0' && stop_budget > 0.0 && ++calls % CLOCKEVERY == 0) {
+      spent = (instr_clock() - started) / 1e9;
+      if (spent >= stop_budget)
+        sprintf(reason, "wall-clock budget of %g seconds spent", stop_budget);
+    }
+    if (reason[0] == '\0')
+      return 0;
+  }
+  stop_reason = reason;
+  return 1;
+}
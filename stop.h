@@ -0,0 +1,35 @@
+/* ******************************************************************
+   Conditions that end a run before its events run out.
+
+   A run normally ends when no events are left, after every flow has
+   had its nsimmax messages and the protocols have finished.  With high
+   loss that can take very long.  Any of these ends it earlier, and the
+   report then says which one did:
+
+   - a virtual time horizon: events at or after stop_time are not run
+   - a target number of messages, or of bytes, delivered to layer 5
+   - steady goodput: the goodput of each of the last STOP_BLOCKS blocks
+     of stop_block time units lies within stop_steady (relative) of
+     their mean
+   - a wall-clock budget of stop_budget seconds
+**********************************************************************/
+
+#define STOP_BLOCKS 5           /* blocks compared by the steady-state test */
+
+extern double stop_time;        /* virtual time horizon, < 0 for none */
+extern long long stop_msgs;     /* messages delivered, 0 for no target */
+extern long long stop_bytes;    /* bytes delivered, 0 for no target */
+extern double stop_steady;      /* relative goodput spread, 0 for no test */
+extern double stop_block;       /* time units per goodput block */
+extern double stop_budget;      /* wall-clock seconds, 0 for none */
+extern int stop_any;            /* some condition is set */
+
+/* why the last run stopped early, NULL if it ran out of events */
+extern const char *stop_reason;
+
+/* start the clock and the goodput blocks of a run at time 0 */
+extern void stop_reset(void);
+
+/* should the run stop before its next event, at time now, with msgs
+   messages and bytes bytes delivered so far.  Sets stop_reason */
+extern int stop_check(double now, long long msgs, long long bytes);
@@ -0,0 +1,335 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "traffic.h"
+
+#define UNIFORM 0
+#define POISSON 1
+#define CBR     2
+#define ONOFF   3
+#define PARETO  4
+#define TRACE   5
+
+int traffic_specs = 0;
+int traffic_sized = 0;
+
+static struct traffic specs[TRAFFIC_MAXSPECS];
+
+struct tracefile {
+  char name[256];
+  const struct tracerec *rec;   /* the mapped file */
+  size_t n;                     /* records in it */
+};
+
+static struct tracefile traces[TRAFFIC_MAXSPECS * TRAFFIC_MAXPARTS];
+static int ntraces = 0;
+
+/* map a trace file, once however many sources replay it */
+static struct tracefile *maptrace(const char *name)
+{
+  struct tracefile *f;
+  struct stat st;
+  void *p;
+  int i, fd;
+
+  for (i = 0; i < ntraces; i++)
+    if (strcmp(traces[i].name, name) == 0)
+      return &traces[i];
+  f = &traces[ntraces];
+  if (strlen(name) >= sizeof(f->name)) {
+    printf("trace file name too long: %s\n", name);
+    return NULL;
+  }
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    printf("could not open trace file %s\n", name);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0) {
+    printf("could not open trace file %s\n", name);
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size % sizeof(struct tracerec) != 0) {
+    printf("trace file %s is not a whole number of %d byte records\n", name,
+           (int)sizeof(struct tracerec));
+    close(fd);
+    return NULL;
+  }
+  p = NULL;
+  if (st.st_size > 0) {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      printf("could not map trace file %s\n", name);
+      close(fd);
+      return NULL;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);   /* read ahead, drop behind */
+  }
+  close(fd);
+  strcpy(f->name, name);
+  f->rec = p;
+  f->n = st.st_size / sizeof(struct tracerec);
+  ntraces++;
+  return f;
+}
+
+int traffic_add(const char *spec)
+{
+  char buf[512];
+  char *part;
+  struct traffic *t;
+  struct source *s;
+  int n;
+
+  if (traffic_specs == TRAFFIC_MAXSPECS || strlen(spec) >= sizeof(buf))
+    return 0;
+  t = &specs[traffic_specs];
+  t->n = 0;
+  strcpy(buf, spec);
+  for (part = strtok(buf, "+"); part != NULL; part = strtok(NULL, "+")) {
+    if (t->n == TRAFFIC_MAXPARTS)
+      return 0;
+    s = &t->part[t->n];
+    memset(s, 0, sizeof(struct source));
+    n = 0;
+    if (strcmp(part, "uniform") == 0)
+      s->kind = UNIFORM;
+    else if (strcmp(part, "poisson") == 0)
+      s->kind = POISSON;
+    else if (strcmp(part, "cbr") == 0)
+      s->kind = CBR;
+    else if (sscanf(part, "onoff:%lf:%lf%n", &s->a, &s->b, &n) == 2 && part[n] == '\0'
+             && s->a > 0.0 && s->b >= 0.0)
+      s->kind = ONOFF;
+    else if (sscanf(part, "pareto:%lf%n", &s->a, &n) == 1 && part[n] == '\0' && s->a > 1.0)
+      s->kind = PARETO;
+    else if (strncmp(part, "trace:", 6) == 0 && part[6] != '\0') {
+      if ((s->trace = maptrace(part + 6)) == NULL)
+        return 0;
+      s->kind = TRACE;
+      traffic_sized = 1;
+    }
+    else
+      return 0;
+    t->n++;
+  }
+  if (t->n == 0)
+    return 0;
+  traffic_specs++;
+  return 1;
+}
+
+/* uniform on (0,1] as far as rng allows */
+static double open01(double (*rng)(void))
+{
+  double u = 1.0 - rng();
+
+  return u > 0.0 ? u : 1e-300;
+}
+
+static double expo(double mean, double (*rng)(void))
+{
+  return -mean * log(open01(rng));
+}
+
+/* time from one arrival of a generated source to the next */
+static double gap(struct source *s, double (*rng)(void))
+{
+  double x, g;
+
+  switch (s->kind) {
+  case UNIFORM:
+    return s->mean * rng() * 2;
+  case POISSON:
+    return expo(s->mean, rng);
+  case CBR:
+    return s->mean;
+  case PARETO:        /* scale so that the mean is lambda */
+    return s->mean * (s->a - 1.0) / s->a / pow(open01(rng), 1.0 / s->a);
+  case ONOFF:         /* memoryless, so a gap cut short can be redrawn */
+    for (g = 0.0;; ) {
+      if (!s->on) {
+        g += s->left;
+        s->on = 1;
+        s->left = expo(s->a, rng);
+      }
+      x = expo(s->mean, rng);
+      if (x <= s->left) {
+        s->left -= x;
+        return g + x;
+      }
+      g += s->left;
+      s->on = 0;
+      s->left = expo(s->b, rng);
+    }
+  }
+  return s->mean;
+}
+
+/* move a trace source on to the next record of its flow */
+static void replay(struct source *s, double origin)
+{
+  const struct tracerec *r;
+  double at;
+
+  for (; s->cursor < s->trace->n; s->cursor++) {
+    r = &s->trace->rec[s->cursor];
+    if (r->flow % s->nflows == (uint32_t)s->flow) {
+      at = origin + (r->time - s->trace->rec[0].time);
+      s->next = at > s->next ? at : s->next;   /* never back in time */
+      s->size = (int)r->size;
+      s->cursor++;
+      return;
+    }
+  }
+  s->next = TRAFFIC_END;
+}
+
+void traffic_start(struct traffic *t, int flow, int nflows, double lambda,
+                   double now, double (*rng)(void))
+{
+  struct source *s;
+  int i;
+
+  *t = specs[flow % traffic_specs];
+  for (i = 0; i < t->n; i++) {
+    s = &t->part[i];
+    s->mean = lambda;
+    s->size = 0;
+    s->flow = flow;
+    s->nflows = nflows;
+    s->cursor = 0;
+    s->next = now;
+    if (s->kind == ONOFF) {     /* start in the long-run mix of periods */
+      s->on = rng() < s->a / (s->a + s->b);
+      s->left = expo(s->on ? s->a : s->b, rng);
+    }
+    if (s->kind == TRACE) {
+      s->a = now;               /* where the trace's time starts */
+      replay(s, s->a);
+    }
+    else
+      s->next += gap(s, rng);
+  }
+}
+
+double traffic_next(struct traffic *t, double (*rng)(void), int *size)
+{
+  struct source *s = NULL;
+  double at;
+  int i;
+
+  for (i = 0; i < t->n; i++)     /* the source whose arrival comes first */
+    if (t->part[i].next != TRAFFIC_END && (s == NULL || t->part[i].next < s->next))
+      s = &t->part[i];
+  if (s == NULL)
+    return TRAFFIC_END;
+  at = s->next;
+  *size = s->size;
+  if (s->kind == TRACE)
+    replay(s, s->a);
+  else
+    s->next += gap(s, rng);
+  return at;
+}
+
+/************************ self test *************************/
+
+#define DRAWS  400000     /* gaps drawn per generator */
+#define TRACEN 3000       /* records in the test trace */
+
+/* draw gaps from spec, compare their mean and coefficient of variation
+   with the expected ones (cv < 0 for any) */
+static int checkgaps(const char *spec, double lambda, double mean, double cv,
+                     double (*rng)(void))
+{
+  struct traffic t;
+  double at, last = 0.0, g, sum = 0.0, sumsq = 0.0, m, c;
+  int i, size, ok;
+
+  traffic_specs = 0;
+  if (!traffic_add(spec)) {
+    printf("%-18s bad spec  FAIL\n", spec);
+    return 1;
+  }
+  traffic_start(&t, 0, 1, lambda, 0.0, rng);
+  for (i = 0; i < DRAWS; i++) {
+    at = traffic_next(&t, rng, &size);
+    g = at - last;
+    last = at;
+    sum += g;
+    sumsq += g * g;
+  }
+  m = sum / DRAWS;
+  c = sqrt(sumsq / DRAWS - m * m) / m;
+  ok = fabs(m - mean) <= 0.02 * mean && (cv < 0.0 || fabs(c - cv) <= 0.02 + 0.02 * cv);
+  printf("%-18s mean gap %9.4f (expected %9.4f)  cv %6.3f", spec, m, mean, c);
+  if (cv >= 0.0)
+    printf(" (expected %6.3f)", cv);
+  printf("  %s\n", ok ? "ok" : "FAIL");
+  return !ok;
+}
+
+/* replay a small trace written for the purpose, for flow 1 of 3 */
+static int checktrace(double (*rng)(void))
+{
+  char name[] = "/tmp/tracetestXXXXXX";
+  char spec[64];
+  struct tracerec r;
+  struct traffic t;
+  double at;
+  int fd, i, size, n = 0, bad = 0;
+
+  if ((fd = mkstemp(name)) < 0) {
+    printf("trace replay: no temporary file  FAIL\n");
+    return 1;
+  }
+  for (i = 0; i < TRACEN; i++) {
+    r.time = 1000.0 + 0.5 * i;
+    r.size = 100 + i;
+    r.flow = i;
+    if (write(fd, &r, sizeof(r)) != sizeof(r))
+      bad++;
+  }
+  close(fd);
+  sprintf(spec, "trace:%s", name);
+  traffic_specs = 0;
+  if (bad || !traffic_add(spec)) {
+    unlink(name);
+    printf("trace replay: could not write or map %s  FAIL\n", name);
+    return 1;
+  }
+  unlink(name);              /* the mapping stays valid */
+  traffic_start(&t, 1, 3, 10.0, 5.0, rng);
+  while ((at = traffic_next(&t, rng, &size)) != TRAFFIC_END) {
+    i = 3 * n + 1;           /* record expected */
+    if (at != 5.0 + 0.5 * i || size != 100 + i)
+      bad++;
+    n++;
+  }
+  printf("trace replay: %d of %d records for flow 1 of 3, %d wrong  %s\n",
+         n, TRACEN, bad, n == TRACEN / 3 && bad == 0 ? "ok" : "FAIL");
+  return n != TRACEN / 3 || bad != 0;
+}
+
+int traffic_selftest(double (*rng)(void))
+{
+  int failed = 0;
+
+  printf("-----  Traffic sources, %d gaps each, lambda 10 -------- \n", DRAWS);
+  failed += checkgaps("uniform", 10.0, 10.0, 1.0 / sqrt(3.0), rng);
+  failed += checkgaps("poisson", 10.0, 10.0, 1.0, rng);
+  failed += checkgaps("cbr", 10.0, 10.0, 0.0, rng);
+  failed += checkgaps("pareto:2.5", 10.0, 10.0, -1.0, rng);
+  failed += checkgaps("pareto:5", 10.0, 10.0, 1.0 / sqrt(15.0), rng);
+  failed += checkgaps("onoff:200:100", 10.0, 15.0, -1.0, rng);
+  failed += checkgaps("poisson+poisson", 10.0, 5.0, 1.0, rng);
+  failed += checktrace(rng);
+  traffic_specs = 0;
+  return failed;
+}
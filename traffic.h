@@ -0,0 +1,77 @@
+/* ******************************************************************
+   Traffic sources: when layer 5 hands each flow its messages.
+
+   Without --traffic a flow's messages arrive the original way, at gaps
+   uniform on [0, 2*lambda].  A traffic spec instead names a source:
+
+     uniform           gaps uniform on [0, 2*lambda]
+     poisson           exponential gaps of mean lambda
+     cbr               a message every lambda time units
+     onoff:ON:OFF      Poisson arrivals of mean gap lambda during on
+                       periods, none during off periods; the periods are
+                       exponential with means ON and OFF (a two-state
+                       Markov modulated Poisson process)
+     pareto:ALPHA      Pareto gaps of mean lambda and shape ALPHA > 1
+     trace:FILE        replay a binary trace of struct tracerec records,
+                       memory mapped so that a capture of any size is
+                       read from disk as it is replayed
+
+   Sources joined by '+' are superposed: the flow gets the arrivals of
+   all of them.  Each --traffic gives one spec; flow i uses spec number
+   i modulo the number given, so flows can mix sources.
+**********************************************************************/
+
+#include <stdint.h>
+
+#define TRAFFIC_MAXSPECS 16     /* --traffic options */
+#define TRAFFIC_MAXPARTS 4      /* sources superposed in one spec */
+#define TRAFFIC_END (-1.0)      /* traffic_next(): no more arrivals */
+
+/* one record of a trace file, in the machine's byte order.  Records
+   are in order of time; flow picks the flow that replays it (modulo
+   the number of flows), so one capture can drive all of them */
+struct tracerec {
+  double time;            /* arrival time, from any origin */
+  uint32_t size;          /* message size in bytes, 0 for the default */
+  uint32_t flow;
+};
+
+struct tracefile;
+
+/* one source of a flow, and where it has got to */
+struct source {
+  int kind;
+  double a, b;            /* its parameters */
+  struct tracefile *trace;
+  double mean;            /* mean gap, lambda */
+  double next;            /* time of its next arrival, TRAFFIC_END if none */
+  int size;               /* size of that message, 0 for the default */
+  int on;                 /* onoff: in an on period */
+  double left;            /* onoff: time left in the period */
+  size_t cursor;          /* trace: next record to look at */
+  int flow, nflows;       /* trace: records replayed */
+};
+
+struct traffic {
+  int n;
+  struct source part[TRAFFIC_MAXPARTS];
+};
+
+extern int traffic_specs;     /* --traffic options given, 0 for none */
+extern int traffic_sized;     /* some source gives message sizes */
+
+/* add a spec from --traffic.  Returns 0 if it is bad */
+extern int traffic_add(const char *spec);
+
+/* set up the sources of flow (of nflows) at time now, with mean gap
+   lambda */
+extern void traffic_start(struct traffic *t, int flow, int nflows, double lambda,
+                          double now, double (*rng)(void));
+
+/* time of the flow's next arrival, or TRAFFIC_END; sets *size to its
+   message size (0 for the default) */
+extern double traffic_next(struct traffic *t, double (*rng)(void), int *size);
+
+/* check the generators' mean gaps and a trace replay, returns 0 if
+   they are right */
+extern int traffic_selftest(double (*rng)(void));
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "instrument.h"
+#include "checksum.h"
+#include "payload.h"
+#include "fec.h"
+#include "pace.h"
+#include "wire.h"
+#include "transport.h"
+
+int TRACE = 0;             /* for my debugging */
+int nack = 0;              /* B asks for missing packets with NACKs (sr.c) */
+
+__thread int total_ACKs_received = 0;
+__thread int packets_resent = 0;
+__thread int new_ACKs = 0;
+__thread int packets_received = 0;
+__thread int window_full = 0;
+__thread int nacks_sent = 0;
+__thread int packets_resent_nack = 0;
+
+/* parameters */
+int nsimmax = 0;
+float lossprob;
+float corruptprob;
+float lambda;
+int corruptdirection = 2;
+long unit_us = 1000;
+int saturate = 0;
+int msgsize_min = 0, msgsize_max = 0;
+const struct protocol *proto;
+
+/* the run */
+unsigned long long start;
+unsigned long long *stamp;
+atomic_int *published = NULL;
+int nsim = 0;
+int accepted = 0;
+int messages_delivered = 0;
+
+__thread long long packets_sent = 0, packets_lost = 0, packets_corrupt = 0;
+__thread long long packets_read = 0, packets_bad = 0, bytes_delivered = 0;
+__thread int packets_timeout = 0;
+__thread int rcvbuf_released = 0, recoveries = 0, held_max = 0;
+__thread double rcvbuf_delay = 0.0, recoverysum = 0.0;
+
+static __thread unsigned short rng[3];
+
+void transport_seed(unsigned int seed)
+{
+  rng[0] = 0x330e;                /* as srand48(seed) would */
+  rng[1] = seed & 0xffff;
+  rng[2] = seed >> 16;
+}
+
+double uniform01(void)
+{
+  return erand48(rng);
+}
+
+unsigned long long now(void)
+{
+  return instr_clock();
+}
+
+unsigned long long units_to_ns(double t)
+{
+  return t > 0.0 ? (unsigned long long)(t * unit_us * 1000.0) : 0;
+}
+
+unsigned long long interarrival(void)
+{
+  return units_to_ns(2.0 * lambda * uniform01());
+}
+
+void *allocate(size_t size, const char *what)
+{
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    printf("memory allocation for %s failed.", what);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void readparams(const char *title)
+{
+  protocol_require(proto, (msgsize_max > 0 ? PROTO_SEGMENTS : 0) | (fec_k > 0 ? PROTO_FEC : 0) |
+                          (nack ? PROTO_NACK : 0) |
+                          (pace_rate > 0.0 || pace_auto ? PROTO_PACE : 0));
+  printf("-----  %s Version 1.1 -------- \n\n", title);
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+  if (!saturate && lambda <= 0.0) {
+    printf("the time between messages must be > 0 (or use --saturate)\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*********************** THE LOSS AND CORRUPTION STAGES ********************/
+
+/* do losses and corruption apply to packets sent by AorB */
+static int impaired(int AorB)
+{
+  return !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+int lost(int AorB)
+{
+  packets_sent++;
+  if (impaired(AorB) && uniform01() < lossprob) {
+    packets_lost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return 1;
+  }
+  return 0;
+}
+
+void corrupt(int AorB, char *w)
+{
+  if (TRACE>2) {
+    printf("          TOLAYER3: ");
+    wire_print(w);
+  }
+  /* the wire's copy is the stage's to corrupt */
+  if (impaired(AorB) && uniform01() < corruptprob) {
+    packets_corrupt++;
+    wire_corrupt(w, uniform01());
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+}
+
+void input(int AorB, const char *data, int len)
+{
+  struct pkt packet;
+
+  packets_read++;
+  if (!wire_unpack(data, len, &packet)) {
+    packets_bad++;              /* not one of ours */
+    return;
+  }
+  if (AorB == A)
+    proto->A_input(&packet);
+  else
+    proto->B_input(&packet);
+  pkt_release(&packet);         /* the protocol took its own references */
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void tolayer3_batch(int AorB, const struct pkt packets[], int n)
+{
+  int k;
+
+  for (k = 0; k < n; k++)
+    transmit(AorB, &packets[k]);
+}
+
+void tolayer3_ref(int AorB, const struct pkt *packet)
+{
+  transmit(AorB, packet);
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  packet.length = packet.offset = packet.msglen = 0;   /* always classic */
+  packet.buf = NULL;
+  transmit(AorB, &packet);
+}
+
+double get_sim_time(void)
+{
+  return (double)(now() - start) / (unit_us * 1000.0);
+}
+
+void rcvbuf_occupancy(int held)
+{
+  if (held > held_max)
+    held_max = held;
+}
+
+void rcvbuf_release(double arrived)
+{
+  rcvbuf_released++;
+  rcvbuf_delay += get_sim_time() - arrived;
+}
+
+void loss_recovered(double missed)
+{
+  recoveries++;
+  recoverysum += get_sim_time() - missed;
+}
+
+/* account for a message handed to layer 5.  Deliveries are matched to
+   A's acceptances in order, which is exact for protocols that deliver
+   in order; the stamp becomes the message's latency */
+static void delivered(int nbytes)
+{
+  bytes_delivered += nbytes;
+  if (messages_delivered < nsimmax)
+    stamp[messages_delivered] = now() - stamp[messages_delivered];
+  messages_delivered++;
+  if (published != NULL)
+    atomic_store_explicit(published, messages_delivered, memory_order_release);
+}
+
+void tolayer5(int AorB, const char datasent[20])
+{
+  int i;
+
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at %c: ", AorB == A ? 'A' : 'B');
+    for (i=0; i<20; i++)
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  delivered(20);
+}
+
+void tolayer5_buf(int AorB, const struct pbuf *buf, int length)
+{
+  if (TRACE>2)
+    printf("          TOLAYER5: %d bytes (%c...) received by application at %c\n",
+           length, buf->data[0], AorB == A ? 'A' : 'B');
+  delivered(length);
+}
+
+/************************** LAYER 5 **************************/
+
+int offer(void)
+{
+  struct msg msg2give;
+  int i, j, dropped;
+
+  j = nsim % 26;
+  for (i=0; i<20; i++)
+    msg2give.data[i] = 97 + j;
+  msg2give.length = 20;
+  msg2give.buf = NULL;
+  if (msgsize_max > 0) {          /* message bytes go in a shared buffer */
+    msg2give.length = msgsize_min + (int)(uniform01() * (msgsize_max - msgsize_min + 1));
+    if (msg2give.length > msgsize_max)
+      msg2give.length = msgsize_max;
+    msg2give.buf = pbuf_alloc(msg2give.length);
+    memset(msg2give.buf->data, 97 + j, msg2give.length);
+  }
+  stamp[accepted] = now();        /* before its first packet can reach B */
+  dropped = window_full;
+  proto->A_output(&msg2give);
+  if (msg2give.buf != NULL)       /* layer 4 holds its own references */
+    pbuf_unref(msg2give.buf);
+  if (window_full == dropped)
+    accepted++;
+  else if (saturate) {
+    window_full = dropped;        /* not lost, it is offered again */
+    return 0;
+  }
+  nsim++;
+  return 1;
+}
+
+/************************** OPTIONS **************************/
+
+const char *optval(const char *arg, const char *name)
+{
+  size_t n = strlen(name);
+
+  if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+    return arg + n + 1;
+  return NULL;
+}
+
+int transport_option(const char *arg)
+{
+  const char *v;
+
+  if ((v = optval(arg, "--unit")) != NULL) {
+    if ((unit_us = atol(v)) < 1) {
+      printf("bad time unit: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if (strcmp(arg, "--saturate") == 0)
+    saturate = 1;
+  else if (strcmp(arg, "--nack") == 0)
+    nack = 1;
+  else if ((v = optval(arg, "--fec")) != NULL) {
+    fec_k = atoi(v);
+    if (fec_k < 0 || fec_k > FEC_MAXK) {
+      printf("bad FEC group size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--pace")) != NULL) {
+    if (strcmp(v, "auto") == 0)
+      pace_auto = 1;
+    else if ((pace_rate = atof(v)) <= 0.0) {
+      printf("bad pacing rate: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--pace-burst")) != NULL) {
+    pace_burst = atoi(v);
+    if (pace_burst < 1) {
+      printf("bad pacing burst: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--msgsize")) != NULL) {
+    if (sscanf(v, "%d-%d", &msgsize_min, &msgsize_max) != 2)
+      msgsize_max = msgsize_min;
+    if (msgsize_min < 1 || msgsize_max < msgsize_min) {
+      printf("bad message size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--mss")) != NULL) {
+    payload_mss = atoi(v);
+    if (payload_mss < 1) {
+      printf("bad segment size: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--protocol")) != NULL) {
+    if (!protocol_add(v)) {
+      printf("unknown protocol: %s; linked in:", v);
+      protocol_names();
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if ((v = optval(arg, "--checksum")) != NULL) {
+    if (!checksum_select(v)) {
+      printf("unknown checksum engine: %s\n", v);
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+    return 0;
+  return 1;
+}
+
+/************************** REPORT **************************/
+
+static int byvalue(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+void transport_report(const char *name, double wall)
+{
+  double sum = 0.0;
+  int i, n = messages_delivered < accepted ? messages_delivered : accepted;
+
+  printf(" %s run ended at time %f (%f s, %ld us per time unit)\n after attempting to send %d msgs from layer5\n",
+         name, wall * 1e6 / unit_us, wall, unit_us, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  if (msgsize_max > 0 || fec_k > 0)
+    printf("number of bytes delivered to application:  %lld \n", bytes_delivered);
+  if (held_max > 0) {
+    printf("number of held packets later delivered in order at B:  %d \n", rcvbuf_released);
+    printf("average reordering delay of held packets:  %f \n", rcvbuf_released > 0 ? rcvbuf_delay / rcvbuf_released : 0.0);
+    printf("receive buffer occupancy:  %d maximum \n", held_max);
+  }
+  if (recoveries > 0)
+    printf("average loss recovery latency at B:  %f over %d packets \n", recoverysum / recoveries, recoveries);
+  fec_report();
+  pace_report();
+  if (nack) {
+    printf("number of NACKs sent by B:  %d \n", nacks_sent);
+    printf("number of packet resends triggered by NACK:  %d, by timeout:  %d \n",
+           packets_resent_nack, packets_resent - packets_resent_nack);
+  }
+  printf("messages delivered per second:  %f \n", wall > 0.0 ? messages_delivered / wall : 0.0);
+  if (msgsize_max > 0)
+    printf("bytes delivered per second:  %f \n", wall > 0.0 ? bytes_delivered / wall : 0.0);
+  if (n > 0) {
+    for (i = 0; i < n; i++)
+      sum += stamp[i];
+    qsort(stamp, n, sizeof(stamp[0]), byvalue);
+    printf("message latency:  %f us average, %f median, %f 90th, %f 99th, %f 99.9th percentile, %f maximum \n",
+           sum / n / 1000.0, stamp[n / 2] / 1000.0, stamp[(int)(0.9 * (n - 1))] / 1000.0,
+           stamp[(int)(0.99 * (n - 1))] / 1000.0, stamp[(int)(0.999 * (n - 1))] / 1000.0, stamp[n - 1] / 1000.0);
+  }
+}
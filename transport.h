@@ -0,0 +1,91 @@
+/* ******************************************************************
+   The host side the transports share (udp.c, shm.c, rt.c).
+
+   A transport runs the protocol outside the emulator and differs from
+   the others only in how packets travel and how time goes by.  What
+   does not depend on that lives here: the run's parameters and the
+   options they all take, the loss and corruption stages in front of
+   the wire, the student-callable routines other than the timers,
+   layer 5 at both ends and the part of the report they have in common.
+
+   A transport provides transmit(), which this file's tolayer3()
+   routines call, and the timer routines.  The counters are per thread
+   (rt.c runs A and B on threads of their own); a transport that runs
+   a side elsewhere copies that side's counts into them before
+   transport_report().
+   emulator.h must be included first.
+**********************************************************************/
+
+#include <stdatomic.h>
+
+/* parameters */
+extern int nsimmax;               /* number of msgs to generate, then stop */
+extern float lossprob;            /* probability that a packet is dropped  */
+extern float corruptprob;         /* probability that one bit is packet is flipped */
+extern float lambda;              /* arrival rate of messages from layer 5 */
+extern int corruptdirection;      /* 0 A->B, 1 A<-B, 2 both */
+extern long unit_us;              /* microseconds per time unit, --unit */
+extern int saturate;              /* offer messages whenever the window has room */
+extern int msgsize_min, msgsize_max;   /* --msgsize, 0 for classic */
+extern const struct protocol *proto;   /* what A and B run, --protocol */
+
+/* the run */
+extern unsigned long long start;  /* clock at time 0, ns */
+extern unsigned long long *stamp; /* accept time of message k, then its latency;
+                                     nsimmax + 1 of them, the transport's */
+extern atomic_int *published;     /* where B's count of deliveries goes for A
+                                     to see, NULL if A sees messages_delivered */
+extern int nsim;                  /* messages from layer 5 so far */
+extern int accepted;              /* of those, taken by layer 4 */
+extern int messages_delivered;
+
+/* what each thread counted */
+extern __thread long long packets_sent, packets_lost, packets_corrupt;
+extern __thread long long packets_read, packets_bad, bytes_delivered;
+extern __thread int packets_timeout;
+extern __thread int rcvbuf_released, recoveries, held_max;
+extern __thread double rcvbuf_delay, recoverysum;
+
+/* the transport's: put a packet sent by AorB on its way to the other side */
+extern void transmit(int AorB, const struct pkt *packet);
+
+/* this thread's random numbers, uniform on [0,1], from seed */
+extern void transport_seed(unsigned int seed);
+extern double uniform01(void);
+
+extern unsigned long long now(void);                 /* ns */
+extern unsigned long long units_to_ns(double t);
+
+/* the gap to the next message from layer 5 */
+extern unsigned long long interarrival(void);
+
+/* malloc() or exit */
+extern void *allocate(size_t size, const char *what);
+
+/* check that proto does what the options ask of it, then read the
+   run's parameters, under the title of the transport */
+extern void readparams(const char *title);
+
+/* the loss stage: count a packet sent by AorB, 1 if it is lost */
+extern int lost(int AorB);
+
+/* the corruption stage, on the packet packed at w by AorB, printed
+   first for TRACE 3 */
+extern void corrupt(int AorB, char *w);
+
+/* hand the len bytes of a packet that reached AorB to the protocol */
+extern void input(int AorB, const char *data, int len);
+
+/* give A the next message from layer 5.  With --saturate a message the
+   window has no room for waits in layer 5 instead of being dropped;
+   returns 0 if that happened */
+extern int offer(void);
+
+/* value of a "--name=value" option, or NULL if arg is not that option */
+extern const char *optval(const char *arg, const char *name);
+
+/* an option every transport takes; returns 0 if arg is not one */
+extern int transport_option(const char *arg);
+
+/* the report up to the message latencies, for a run of wall seconds */
+extern void transport_report(const char *name, double wall);
@@ -0,0 +1,535 @@
+/* ******************************************************************
+   UDP TRANSPORT: the layer 3 and below environment on real sockets.
+
+   Runs the same protocol code as the emulator (it provides the same
+   student-callable routines), but A and B each get a UDP socket bound
+   to 127.0.0.1 and every packet really crosses the loopback interface:
+   - tolayer3() queues the packet, which goes out with the next
+     sendmmsg() on the sender's socket; the receiver reads its socket
+     with recvmmsg() and hands each packet to A_input() or B_input()
+   - starttimer() arms a timerfd, whose expiry calls the timer handler
+   - messages arrive from layer 5 on a timerfd too, at gaps uniform on
+     [0, 2*lambda], or as fast as the send window takes them
+   - one epoll loop on a single thread waits for all of these, so the
+     callbacks run one at a time as they do in the emulator
+
+   Time is real time since the start of the run, in units of --unit
+   microseconds (1000 by default, so the protocols' RTT of 16 is 16
+   ms).  Loopback neither loses nor corrupts, so the loss and
+   corruption probabilities, and an optional delay, are applied by a
+   shim in front of the sender's socket, like netem would.  Packets
+   leave the shim in the order they entered it.
+
+   What is not about sockets is shared with the other transports, in
+   transport.c.
+
+   Linux only: epoll, timerfd, sendmmsg and recvmmsg.
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "checksum.h"
+#include "payload.h"
+#include "pace.h"
+#include "wire.h"
+#include "transport.h"
+
+#define BATCH    64        /* datagrams per sendmmsg() or recvmmsg() */
+#define MAXWIRE  65000     /* largest datagram */
+#define IDLE_MS  5000      /* a run with nothing happening for this long ends */
+
+/* tags of the epoll sources */
+#define EV_SOCK    0       /* + A or B */
+#define EV_TIMER   2       /* + A or B */
+#define EV_PACE    4       /* + A or B */
+#define EV_ARRIVAL 6
+#define EV_SHIM    7
+
+/* datagrams queued for one socket */
+struct outq {
+  char *slot;               /* BATCH slots of slotsize bytes */
+  int len[BATCH];
+  int n;
+};
+
+/* a datagram held back by the shim's delay */
+struct held {
+  unsigned long long at;    /* release time, ns */
+  int len;
+  char *data;
+};
+
+/* the shim's delay line for packets sent by one side, in release order */
+struct delayline {
+  struct held *q;
+  int cap, head, len;
+  unsigned long long last;  /* release time of the newest, keeps the order */
+};
+
+/* parameters, besides transport.h's */
+static double delay_min = 0.0;    /* shim delay and jitter, time units, --delay */
+static double delay_jitter = 0.0;
+
+/* sockets and timers */
+static int sock[2];
+static struct sockaddr_in addr[2];
+static int timerfd[2], pacefd[2], arrivalfd, shimfd, epfd;
+static int timeron[2];
+static struct pacer *pacing[2];
+static struct outq out[2];
+static struct delayline line[2];
+static int slotsize;
+static struct mmsghdr rmsg[BATCH];
+static struct iovec riov[BATCH];
+static char *rbuf;
+
+/* the run */
+static unsigned long long nextarrival;
+
+/* statistics of the transport */
+static long long packets_delayed = 0;
+static long long sendcalls = 0, recvcalls = 0;
+
+static void die(const char *what)
+{
+  printf("%s failed: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* arm fd to go off at the absolute time at (ns on the instr_clock()
+   clock), or disarm it for at 0 */
+static void armat(int fd, unsigned long long at)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if (at != 0) {
+    its.it_value.tv_sec = at / 1000000000ULL;
+    its.it_value.tv_nsec = at % 1000000000ULL;
+  }
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+    die("timerfd_settime");
+}
+
+/* consume a timerfd's expiry; 0 if it was disarmed or rearmed since */
+static int expired(int fd)
+{
+  uint64_t n;
+
+  return read(fd, &n, sizeof(n)) == sizeof(n);
+}
+
+static void watch(int fd, uint32_t tag)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    die("epoll_ctl");
+}
+
+static int newtimer(uint32_t tag)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (fd < 0)
+    die("timerfd_create");
+  watch(fd, tag);
+  return fd;
+}
+
+/* a socket on an ephemeral loopback port */
+static int newsocket(struct sockaddr_in *a, uint32_t tag)
+{
+  socklen_t n = sizeof(*a);
+  int fd, size = 4 << 20;
+
+  if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    die("socket");
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  memset(a, 0, sizeof(*a));
+  a->sin_family = AF_INET;
+  a->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a->sin_port = 0;
+  if (bind(fd, (struct sockaddr *)a, sizeof(*a)) < 0)
+    die("bind");
+  if (getsockname(fd, (struct sockaddr *)a, &n) < 0)
+    die("getsockname");
+  watch(fd, tag);
+  return fd;
+}
+
+static void setup(void)
+{
+  int i;
+
+  slotsize = wire_size();
+  if (slotsize > MAXWIRE) {
+    printf("segment size %d is too large for a datagram\n", payload_mss);
+    exit(EXIT_FAILURE);
+  }
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    die("epoll_create1");
+  for (i = A; i <= B; i++) {
+    sock[i] = newsocket(&addr[i], EV_SOCK + i);
+    timerfd[i] = newtimer(EV_TIMER + i);
+    pacefd[i] = newtimer(EV_PACE + i);
+    out[i].slot = allocate((size_t)BATCH * slotsize, "a send queue");
+    out[i].n = 0;
+  }
+  arrivalfd = newtimer(EV_ARRIVAL);
+  shimfd = newtimer(EV_SHIM);
+  rbuf = allocate((size_t)BATCH * slotsize, "the receive buffers");
+  stamp = allocate((size_t)(nsimmax + 1) * sizeof(stamp[0]), "time stamps");
+  for (i = 0; i < BATCH; i++) {
+    riov[i].iov_base = rbuf + (size_t)i * slotsize;
+    riov[i].iov_len = slotsize;
+    memset(&rmsg[i], 0, sizeof(rmsg[i]));
+    rmsg[i].msg_hdr.msg_iov = &riov[i];
+    rmsg[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/************************** THE SENDING SIDE ***************************/
+
+/* send the datagrams queued for AorB's socket to the other side */
+static void flush(int AorB)
+{
+  struct outq *o = &out[AorB];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, done = 0, n;
+
+  if (o->n == 0)
+    return;
+  for (i = 0; i < o->n; i++) {
+    iov[i].iov_base = o->slot + (size_t)i * slotsize;
+    iov[i].iov_len = o->len[i];
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_name = &addr[(AorB + 1) % 2];
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (done < o->n) {
+    n = sendmmsg(sock[AorB], msgs + done, o->n - done, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      die("sendmmsg");
+    }
+    sendcalls++;
+    done += n;
+  }
+  o->n = 0;
+}
+
+/* a slot to write a datagram for AorB's socket into */
+static char *outslot(int AorB)
+{
+  if (out[AorB].n == BATCH)
+    flush(AorB);
+  return out[AorB].slot + (size_t)out[AorB].n * slotsize;
+}
+
+/* the shim lets a datagram of AorB go: out with the next sendmmsg() */
+static void release(int AorB, const char *data, int len)
+{
+  char *slot = outslot(AorB);
+
+  memcpy(slot, data, len);
+  out[AorB].len[out[AorB].n++] = len;
+}
+
+/* the earliest release time of the delay lines, 0 if they are empty */
+static unsigned long long nextrelease(void)
+{
+  unsigned long long t, first = 0;
+  int i;
+
+  for (i = A; i <= B; i++)
+    if (line[i].len > 0) {
+      t = line[i].q[line[i].head].at;
+      if (first == 0 || t < first)
+        first = t;
+    }
+  return first;
+}
+
+/* hold a datagram of AorB in the shim until its delay is over */
+static void delay(int AorB, const char *data, int len)
+{
+  struct delayline *d = &line[AorB];
+  struct held *bigger, *h;
+  unsigned long long at;
+  int i;
+
+  if (d->len == d->cap) {
+    bigger = allocate((d->cap ? 2 * d->cap : 64) * sizeof(struct held), "the delay line");
+    for (i = 0; i < d->cap; i++)  /* the free slots keep their buffers */
+      bigger[i] = d->q[(d->head + i) % d->cap];
+    for (; i < (d->cap ? 2 * d->cap : 64); i++)
+      bigger[i].data = NULL;
+    free(d->q);
+    d->q = bigger;
+    d->cap = d->cap ? 2 * d->cap : 64;
+    d->head = 0;
+  }
+  at = now() + units_to_ns(delay_min + delay_jitter * uniform01());
+  if (at < d->last)               /* the shim does not reorder */
+    at = d->last;
+  d->last = at;
+  h = &d->q[(d->head + d->len) % d->cap];
+  if (h->data == NULL)
+    h->data = allocate(slotsize, "a delayed packet");
+  memcpy(h->data, data, len);
+  h->len = len;
+  h->at = at;
+  if (d->len++ == 0)
+    armat(shimfd, nextrelease());
+  packets_delayed++;
+}
+
+/* release the datagrams whose delay is over */
+static void undelay(void)
+{
+  unsigned long long t = now();
+  struct delayline *d;
+  struct held *h;
+  int i;
+
+  for (i = A; i <= B; i++) {
+    d = &line[i];
+    while (d->len > 0 && (h = &d->q[d->head])->at <= t) {
+      release(i, h->data, h->len);
+      d->head = (d->head + 1) % d->cap;
+      d->len--;
+    }
+  }
+  armat(shimfd, nextrelease());
+}
+
+/* put a packet sent by AorB on the wire, through the shim */
+void transmit(int AorB, const struct pkt *packet)
+{
+  char buf[MAXWIRE];
+  char *w;
+  int len, delayed = delay_min > 0.0 || delay_jitter > 0.0;
+
+  if (lost(AorB))
+    return;
+  w = delayed ? buf : outslot(AorB);
+  len = wire_pack(w, packet);
+  corrupt(AorB, w);
+  if (delayed)
+    delay(AorB, buf, len);
+  else
+    out[AorB].len[out[AorB].n++] = len;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void stoptimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n", get_sim_time());
+  if (!timeron[AorB]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  armat(timerfd[AorB], 0);
+  timeron[AorB] = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n", get_sim_time());
+  if (timeron[AorB]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  armat(timerfd[AorB], now() + units_to_ns(increment) + 1);
+  timeron[AorB] = 1;
+}
+
+void startpacetimer(int AorB, double increment, struct pacer *pacer)
+{
+  pacing[AorB] = pacer;
+  armat(pacefd[AorB], now() + units_to_ns(increment) + 1);
+}
+
+/************************** THE RECEIVING SIDE *************************/
+
+/* read everything waiting on AorB's socket */
+static void receive(int AorB)
+{
+  int i, n;
+
+  for (;;) {
+    n = recvmmsg(sock[AorB], rmsg, BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      die("recvmmsg");
+    }
+    recvcalls++;
+    for (i = 0; i < n; i++)
+      input(AorB, riov[i].iov_base, rmsg[i].msg_len);
+    if (n < BATCH)
+      return;
+  }
+}
+
+/************************** LAYER 5 **************************/
+
+/* the messages due from layer 5 by now, and the timer for the next */
+static void arrivals(void)
+{
+  unsigned long long t = now();
+
+  while (nsim < nsimmax && nextarrival <= t) {
+    offer();
+    nextarrival += interarrival();
+  }
+  armat(arrivalfd, nsim < nsimmax ? (nextarrival > t ? nextarrival : t + 1) : 0);
+}
+
+/************************** THE EVENT LOOP **************************/
+
+static void run(void)
+{
+  struct epoll_event evs[16];
+  int i, n, tag;
+
+  start = now();
+  proto->A_init();
+  proto->B_init();
+  if (saturate)
+    while (nsim < nsimmax && offer())
+      ;
+  else {
+    nextarrival = start + interarrival();
+    armat(arrivalfd, nextarrival + 1);
+  }
+  while (nsim < nsimmax || messages_delivered < accepted) {
+    flush(A);
+    flush(B);
+    n = epoll_wait(epfd, evs, 16, IDLE_MS);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      die("epoll_wait");
+    }
+    if (n == 0) {
+      printf("nothing happened for %d ms, giving up\n", IDLE_MS);
+      return;
+    }
+    for (i = 0; i < n; i++) {
+      tag = evs[i].data.u32;
+      if (tag == EV_SOCK + A || tag == EV_SOCK + B)
+        receive(tag - EV_SOCK);
+      else if (tag == EV_TIMER + A || tag == EV_TIMER + B) {
+        if (expired(timerfd[tag - EV_TIMER]) && timeron[tag - EV_TIMER]) {
+          timeron[tag - EV_TIMER] = 0;
+          packets_timeout++;
+          if (tag == EV_TIMER + A)
+            proto->A_timerinterrupt();
+          else
+            proto->B_timerinterrupt();
+        }
+      }
+      else if (tag == EV_PACE + A || tag == EV_PACE + B) {
+        if (expired(pacefd[tag - EV_PACE]))
+          pace_release(pacing[tag - EV_PACE], tag - EV_PACE);
+      }
+      else if (tag == EV_ARRIVAL) {
+        if (expired(arrivalfd))
+          arrivals();
+      }
+      else if (tag == EV_SHIM) {
+        if (expired(shimfd))
+          undelay();
+      }
+    }
+    if (saturate)
+      while (nsim < nsimmax && offer())
+        ;
+  }
+  flush(A);
+  flush(B);
+}
+
+/************************** REPORT **************************/
+
+static void report(void)
+{
+  double wall = (now() - start) / 1e9;
+  double cpu, usr, sys;
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  usr = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  cpu = usr + sys;
+  transport_report("UDP", wall);
+  printf("packets sent into layer 3:  %lld (%f per second), lost %lld, corrupted %lld, delayed %lld by the shim \n",
+         packets_sent, wall > 0.0 ? packets_sent / wall : 0.0, packets_lost, packets_corrupt, packets_delayed);
+  printf("packets read from the sockets:  %lld, %lld malformed \n", packets_read, packets_bad);
+  printf("sendmmsg calls:  %lld, %f packets each;  recvmmsg calls:  %lld, %f packets each \n",
+         sendcalls, sendcalls > 0 ? (double)(packets_sent - packets_lost) / sendcalls : 0.0,
+         recvcalls, recvcalls > 0 ? (double)packets_read / recvcalls : 0.0);
+  printf("timer interrupts:  %d \n", packets_timeout);
+  printf("CPU time:  %f s user, %f s system, %f us per message delivered \n", usr, sys,
+         messages_delivered > 0 ? cpu * 1e6 / messages_delivered : 0.0);
+}
+
+/* command line options, given before the interactive parameters */
+static void parseargs(int argc, char *argv[])
+{
+  int i;
+  const char *v;
+
+  for (i = 1; i < argc; i++) {
+    if ((v = optval(argv[i], "--delay")) != NULL) {
+      if (sscanf(v, "%lf:%lf", &delay_min, &delay_jitter) < 1 || delay_min < 0.0 || delay_jitter < 0.0) {
+        printf("bad delay (D[:JITTER]): %s\n", v);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (!transport_option(argv[i])) {
+      printf("unknown option: %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  checksum_init();
+  parseargs(argc, argv);
+  proto = protocol_of(0);
+  readparams("UDP Loopback Transport");
+  transport_seed(9999);
+  setup();
+  run();
+  report();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "checksum.h"
+#include "instrument.h"
+#include "verify.h"
+
+#define MINCAP 64             /* messages in flight before the first growth */
+#define MAXCAP 65536          /* messages in flight before the oldest is given up */
+
+int verify = 0;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+#define BIT(v, id) ((v)->bits[((id) & ((v)->cap - 1)) / 64] & (1ULL << ((id) % 64)))
+#define SETBIT(v, id) ((v)->bits[((id) & ((v)->cap - 1)) / 64] |= 1ULL << ((id) % 64))
+#define CLEARBIT(v, id) ((v)->bits[((id) & ((v)->cap - 1)) / 64] &= ~(1ULL << ((id) % 64)))
+
+unsigned int verify_stamp(const struct verifier *v, char *data, int len)
+{
+  unsigned int id = v->next;
+  int i;
+
+  if (len >= VERIFY_TAG)
+    for (i = len - 1; i >= len - VERIFY_TAG; i--, id >>= 4)
+      data[i] = hexdigits[id & 15];
+  return checksum_bytes(data, len);
+}
+
+#define BYTES(c) (0x0101010101010101ULL * (c))
+
+/* read the id in a tag; 0 if it is not one.  The eight digits are
+   decoded side by side in a 64-bit word, as branches on the digit
+   ranges mispredict on mixed ids; a tag is valid if its digits encode
+   back to the same bytes */
+static int readtag(const char *tag, unsigned int *id)
+{
+  unsigned long long w, n, x;
+
+  memcpy(&w, tag, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  w = __builtin_bswap64(w);         /* first digit in the top byte */
+#endif
+  n = (w & BYTES(0x0f)) + 9 * ((w >> 6) & BYTES(1));
+  if ((n & BYTES(0x10)) != 0 ||
+      (n + BYTES('0') + 39 * (((n + BYTES(6)) >> 4) & BYTES(1))) != w)
+    return 0;
+  x = (n | n >> 4) & 0x00ff00ff00ff00ffULL;
+  x = (x | x >> 8) & 0x0000ffff0000ffffULL;
+  *id = (unsigned int)(x | x >> 16);
+  return 1;
+}
+
+/* double the window, keeping the messages in flight */
+static void grow(struct verifier *v)
+{
+  unsigned int cap = v->cap ? 2 * v->cap : MINCAP;
+  unsigned int *hash = malloc(cap * sizeof(unsigned int));
+  unsigned long long *bits = calloc(cap / 64, sizeof(unsigned long long));
+  unsigned int id;
+
+  if (hash == NULL || bits == NULL) {
+    printf("memory allocation for the delivery verifier failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (id = v->base; id != v->next; id++) {
+    hash[id & (cap - 1)] = v->hash[id & (v->cap - 1)];
+    if (BIT(v, id))
+      bits[(id & (cap - 1)) / 64] |= 1ULL << (id % 64);
+  }
+  free(v->hash);
+  free(v->bits);
+  v->hash = hash;
+  v->bits = bits;
+  v->cap = cap;
+}
+
+/* give up on the oldest undelivered message, counting it as missing */
+static void giveup(struct verifier *v)
+{
+  v->count.missing++;
+  for (v->base++; v->base != v->next && BIT(v, v->base); v->base++)
+    CLEARBIT(v, v->base);
+}
+
+void verify_accepted(struct verifier *v, unsigned int hash)
+{
+  if (v->next - v->base == v->cap) {
+    if (v->cap < MAXCAP)
+      grow(v);
+    else
+      giveup(v);
+  }
+  v->hash[v->next & (v->cap - 1)] = hash;
+  CLEARBIT(v, v->next);
+  v->next++;
+}
+
+void verify_delivered(struct verifier *v, const char *data, int len)
+{
+  unsigned int id = v->base;
+  int behind;
+
+  if (len >= VERIFY_TAG && !readtag(data + len - VERIFY_TAG, &id)) {
+    v->count.unknown++;
+    return;
+  }
+  if ((int)(id - v->base) < 0) {
+    v->count.duplicates++;           /* the window slid past it */
+    return;
+  }
+  if (id - v->base >= v->next - v->base) {
+    v->count.unknown++;              /* never accepted */
+    return;
+  }
+  if (BIT(v, id)) {
+    v->count.duplicates++;           /* delivered ahead of an older message */
+    return;
+  }
+  behind = (int)(id - v->newest) < 0;
+  if (!behind)
+    v->newest = id + 1;
+  if (checksum_bytes(data, len) != v->hash[id & (v->cap - 1)])
+    v->count.corrupted++;            /* whatever its order */
+  else if (behind)
+    v->count.outoforder++;           /* behind a newer message */
+  else
+    v->count.inorder++;              /* perhaps past a gap, counted once as missing */
+  if (id != v->base) {
+    SETBIT(v, id);
+    return;
+  }
+  for (v->base++; v->base != v->next && BIT(v, v->base); v->base++)
+    CLEARBIT(v, v->base);
+}
+
+void verify_reset(struct verifier *v)
+{
+  v->base = v->next = v->newest = 0;
+  memset(&v->count, 0, sizeof(v->count));
+  if (v->bits != NULL)
+    memset(v->bits, 0, v->cap / 64 * sizeof(unsigned long long));
+}
+
+void verify_count(const struct verifier *v, struct verifycount *sum)
+{
+  unsigned int id;
+
+  sum->inorder += v->count.inorder;
+  sum->outoforder += v->count.outoforder;
+  sum->duplicates += v->count.duplicates;
+  sum->corrupted += v->count.corrupted;
+  sum->unknown += v->count.unknown;
+  sum->missing += v->count.missing;
+  for (id = v->base; id != v->next; id++)
+    sum->missing += !BIT(v, id);
+}
+
+long long verify_report(const struct verifycount *c)
+{
+  long long faults = c->outoforder + c->duplicates + c->corrupted + c->unknown;
+
+  printf("delivery check:  %lld in order, %lld out of order, %lld duplicates, %lld corrupted, "
+         "%lld unknown, %lld never delivered%s \n", c->inorder, c->outoforder, c->duplicates,
+         c->corrupted, c->unknown, c->missing, faults > 0 ? "  FAILED" : "");
+  return faults;
+}
+
+/************************** self test ******************************/
+
+#define SELFMSGS 1024         /* messages in flight when timing */
+#define SELFREPS 100          /* times they are delivered */
+#define SELFLEN 20
+
+/* print the counts c of a delivery pattern next to those expected,
+   returns 1 if they differ */
+static int expect(const char *what, const struct verifycount *c, const struct verifycount *want)
+{
+  int differ = c->inorder != want->inorder || c->outoforder != want->outoforder ||
+               c->duplicates != want->duplicates || c->corrupted != want->corrupted ||
+               c->unknown != want->unknown || c->missing != want->missing;
+
+  printf("%s, counted (expected):  %lld (%lld) in order, %lld (%lld) out of order, "
+         "%lld (%lld) duplicates, %lld (%lld) corrupted, %lld (%lld) unknown, "
+         "%lld (%lld) never delivered%s\n", what, c->inorder, want->inorder,
+         c->outoforder, want->outoforder, c->duplicates, want->duplicates, c->corrupted,
+         want->corrupted, c->unknown, want->unknown, c->missing, want->missing,
+         differ ? "  FAILED" : "");
+  return differ;
+}
+
+int verify_selftest(void)
+{
+  static char msgs[MAXCAP + 10][SELFLEN];
+  struct verifier v;
+  struct verifycount c;
+  static const struct verifycount faults = { 4, 1, 1, 1, 1, 4 };
+  static const struct verifycount overflow = { 1, 0, 1, 0, 0, MAXCAP + 9 };
+  unsigned long long t0, t1, t = 0;
+  char bad[SELFLEN];
+  int i, r, failed = 0;
+
+  checksum_init();
+  memset(&v, 0, sizeof(v));
+  for (i = 0; i < MAXCAP + 10; i++)
+    memset(msgs[i], 'a' + i % 26, SELFLEN);
+  for (r = 0; r < SELFREPS; r++) {   /* in cache, as a message just delivered is */
+    verify_reset(&v);
+    for (i = 0; i < SELFMSGS; i++)
+      verify_accepted(&v, verify_stamp(&v, msgs[i], SELFLEN));
+    t0 = instr_clock();
+    for (i = 0; i < SELFMSGS; i++)
+      verify_delivered(&v, msgs[i], SELFLEN);
+    t1 = instr_clock();
+    t += t1 - t0;
+    failed += v.count.inorder != SELFMSGS || v.base != SELFMSGS;
+  }
+  printf("-----  Delivery verifier -------- \n");
+  printf("check of a %d byte message:  %.2f ns\n", SELFLEN, (double)t / (SELFREPS * SELFMSGS));
+
+  /* 10 accepted messages, delivered as 0 2 1 1 3 4' 9 ? and never 5-8:
+     1 is behind 2, 4' only corrupted, 9 past a gap that counts as
+     missing only */
+  verify_reset(&v);
+  for (i = 0; i < 10; i++)
+    verify_accepted(&v, verify_stamp(&v, msgs[i], SELFLEN));
+  verify_delivered(&v, msgs[0], SELFLEN);
+  verify_delivered(&v, msgs[2], SELFLEN);
+  verify_delivered(&v, msgs[1], SELFLEN);    /* out of order */
+  verify_delivered(&v, msgs[1], SELFLEN);    /* duplicate */
+  verify_delivered(&v, msgs[3], SELFLEN);
+  memcpy(bad, msgs[4], SELFLEN);
+  bad[0] = 'Z';
+  verify_delivered(&v, bad, SELFLEN);        /* corrupted */
+  verify_delivered(&v, msgs[9], SELFLEN);
+  memset(bad, 'x', SELFLEN);
+  verify_delivered(&v, bad, SELFLEN);        /* no tag */
+  memset(&c, 0, sizeof(c));
+  verify_count(&v, &c);
+  failed += expect("known faults", &c, &faults);
+
+  /* MAXCAP + 10 in flight: the 10 oldest are given up, the window stays
+     put, and 0 turning up afterwards can only be taken for a duplicate */
+  verify_reset(&v);
+  for (i = 0; i < MAXCAP + 10; i++)
+    verify_accepted(&v, verify_stamp(&v, msgs[i], SELFLEN));
+  verify_delivered(&v, msgs[0], SELFLEN);
+  verify_delivered(&v, msgs[MAXCAP + 9], SELFLEN);
+  memset(&c, 0, sizeof(c));
+  verify_count(&v, &c);
+  failed += expect("window overflow", &c, &overflow);
+  if (v.cap != MAXCAP) {
+    printf("window of %u messages, expected %d  FAILED\n", v.cap, MAXCAP);
+    failed++;
+  }
+  printf("%s\n", failed ? "FAILED" : "passed");
+  free(v.hash);
+  free(v.bits);
+  return failed;
+}
@@ -0,0 +1,68 @@
+/* ******************************************************************
+   End-to-end delivery verifier (--verify).
+
+   Each message A accepts gets a sequence id, counting from 0 per flow,
+   which the emulator writes into the message's last VERIFY_TAG bytes
+   as hex digits before handing it over; the verifier keeps the CRC-32C
+   of its bytes.  When a message reaches layer 5 the verifier reads the
+   id back and checks that the message
+   - was accepted at all (else its tag is unknown),
+   - was not delivered before (exactly once),
+   - does not come after a newer message (in order),
+   - still has the bytes it was sent with.
+   Each delivery counts under one outcome, a corrupted message as
+   corrupted only.  A message that never arrives counts once, as
+   missing; the ones delivered past it are in order.
+   The delivered ids are kept in a bitmap that slides along with the
+   oldest undelivered message, so it only spans the messages in
+   flight, up to 65536 of them: past that the oldest is given up as
+   missing, and should it turn up later it counts as a duplicate.  A
+   check is a tag decode, a hardware CRC of the message and a few bit
+   operations; --check-verify times it.  Messages shorter than the tag
+   carry none and are taken to be the oldest undelivered one.
+   emulator.h must be included first.
+**********************************************************************/
+
+#define VERIFY_TAG 8          /* tag bytes at the end of a message */
+
+/* deliveries by outcome */
+struct verifycount {
+  long long inorder, outoforder, duplicates, corrupted, unknown;
+  long long missing;          /* accepted, never delivered */
+};
+
+struct verifier {
+  unsigned int *hash;         /* CRC-32C of message id, at id % cap */
+  unsigned long long *bits;   /* delivered flags, bit id % cap */
+  unsigned int cap;           /* a power of two */
+  unsigned int base;          /* oldest accepted id not yet delivered */
+  unsigned int next;          /* id of the next message A accepts */
+  unsigned int newest;        /* one past the newest id delivered */
+  struct verifycount count;   /* missing only those given up, the rest
+                                 is left to verify_count() */
+};
+
+extern int verify;            /* --verify */
+
+/* tag a message offered to A with the id it gets if accepted, return
+   the hash of its bytes */
+extern unsigned int verify_stamp(const struct verifier *v, char *data, int len);
+
+/* A accepted the message stamped last, whose bytes hash to hash */
+extern void verify_accepted(struct verifier *v, unsigned int hash);
+
+/* check a message delivered to layer 5 */
+extern void verify_delivered(struct verifier *v, const char *data, int len);
+
+/* forget the messages of an earlier run */
+extern void verify_reset(struct verifier *v);
+
+/* add v's counts, with the messages still missing, to sum */
+extern void verify_count(const struct verifier *v, struct verifycount *sum);
+
+/* print the counts, returns the number of faulty deliveries */
+extern long long verify_report(const struct verifycount *c);
+
+/* feed a verifier deliveries with known faults and time its checks,
+   returns 0 if every fault was counted as it should be */
+extern int verify_selftest(void);
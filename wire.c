@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "payload.h"
+#include "wire.h"
+
+#define WIRE_SLACK 64           /* a parity packet's header, beyond payload_mss */
+#define WIRE_MAXMSG (1 << 24)   /* largest message size a packet may claim */
+
+int wire_size(void)
+{
+  return sizeof(struct wire) + payload_mss + WIRE_SLACK;
+}
+
+int wire_pack(char *buf, const struct pkt *packet)
+{
+  struct wire *w = (struct wire *)buf;
+
+  w->seqnum = packet->seqnum;
+  w->acknum = packet->acknum;
+  w->checksum = packet->checksum;
+  memcpy(w->payload, packet->payload, 20);
+  w->hasbuf = packet->buf != NULL;
+  if (!w->hasbuf) {
+    w->length = w->offset = w->msglen = 0;
+    return sizeof(struct wire);
+  }
+  if ((int)sizeof(struct wire) + packet->length > wire_size()) {
+    printf("packet of %d bytes does not fit the wire\n", packet->length);
+    exit(EXIT_FAILURE);
+  }
+  w->length = packet->length;
+  w->offset = packet->offset;
+  w->msglen = packet->msglen;
+  memcpy(w + 1, packet->buf->data + packet->offset, packet->length);
+  return sizeof(struct wire) + packet->length;
+}
+
+int wire_unpack(const char *data, int len, struct pkt *packet)
+{
+  const struct wire *w = (const struct wire *)data;
+
+  if (len < (int)sizeof(struct wire) || w->length < 0 || w->offset < 0 || w->msglen > WIRE_MAXMSG
+      || w->offset + w->length > w->msglen || len != (int)sizeof(struct wire) + w->length)
+    return 0;
+  packet->seqnum = w->seqnum;
+  packet->acknum = w->acknum;
+  packet->checksum = w->checksum;
+  memcpy(packet->payload, w->payload, 20);
+  packet->length = w->length;
+  packet->offset = w->offset;
+  packet->msglen = w->msglen;
+  packet->buf = NULL;
+  if (w->hasbuf) {              /* the segment's bytes, where they were sent from */
+    packet->buf = pbuf_alloc(w->msglen);
+    memcpy(packet->buf->data + w->offset, w + 1, w->length);
+  }
+  return 1;
+}
+
+void wire_corrupt(char *buf, double x)
+{
+  struct wire *w = (struct wire *)buf;
+
+  if (x < .75) {
+    if (w->hasbuf && w->length > 0)
+      *(char *)(w + 1) = 'Z';
+    else
+      w->payload[0] = 'Z';
+  }
+  else if (x < .875)
+    w->seqnum = 999999;
+  else
+    w->acknum = 999999;
+}
+
+void wire_print(const char *buf)
+{
+  const struct wire *w = (const struct wire *)buf;
+  int i;
+
+  printf("seq: %d, ack %d, check: %d ", w->seqnum, w->acknum, w->checksum);
+  if (w->hasbuf)
+    printf("%d bytes at %d of %d", w->length, w->offset, w->msglen);
+  else
+    for (i=0; i<20; i++)
+      printf("%c",w->payload[i]);
+  printf("\n");
+}
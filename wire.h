@@ -0,0 +1,41 @@
+/* ******************************************************************
+   Packets as bytes, for the transports that carry them outside the
+   emulator (udp.c, shm.c).
+
+   A packet goes as its struct pkt fields followed by the length bytes
+   of its segment.  Both ends are built from the same code on the same
+   machine, so the byte order and layout are the machine's own.
+   emulator.h must be included first.
+**********************************************************************/
+
+#include <stdint.h>
+
+struct wire {
+  int32_t seqnum;
+  int32_t acknum;
+  int32_t checksum;
+  char payload[20];
+  int32_t length;           /* bytes that follow */
+  int32_t offset;
+  int32_t msglen;
+  int32_t hasbuf;           /* the packet carried a buffer */
+};
+
+/* the most bytes a packet can take, for the current payload_mss */
+extern int wire_size(void);
+
+/* write packet into buf, which has wire_size() bytes; returns the
+   number used */
+extern int wire_pack(char *buf, const struct pkt *packet);
+
+/* the packet in the len bytes at data, its segment in a buffer of its
+   own (message sized, like the sender's) that the caller drops with
+   pkt_release().  Returns 0 if the bytes are not a packet */
+extern int wire_unpack(const char *data, int len, struct pkt *packet);
+
+/* corrupt a packed packet the way the emulator does, x uniform on
+   [0,1] picks what */
+extern void wire_corrupt(char *buf, double x);
+
+/* print a packed packet, for the trace */
+extern void wire_print(const char *buf);